@@ -0,0 +1,164 @@
+/**
+ * @file accept_churn.cpp
+ * @brief Connection churn benchmark for @ref beauty::tcp_server.
+ *
+ * Each client thread repeatedly connects, sends one message, waits for the first byte of the
+ * reply and disconnects. The server side is a plain `tcp_server::listen`, so every iteration goes
+ * through `acceptor::on_accept`, `make_shared<sess_t>` and `session::do_close`.
+ *
+ * Build (from the repository root, verified with GCC 12 and Boost 1.74):
+ *      g++ -std=c++17 -O2 -Iinclude benchmark/accept_churn.cpp src/session.cpp -lpthread
+ *
+ * Build without `USING_LOG`, otherwise the console logging of every accept dominates.
+ *
+ * Usage:
+ *      accept_churn [connections per client] [clients per worker] [base port] [concurrency ...]
+ *
+ * An @ref beauty::acceptor serves one session at a time and only accepts again once it is
+ * disconnected, so one port is listened per client and the number of clients is scaled with the
+ * `concurrency()` setting. Otherwise the sweep would only measure that serialization.
+ */
+
+#include <beauty/beauty.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    using clock_type = std::chrono::steady_clock;
+
+    struct result {
+        int clients = 0;
+        double seconds = 0;
+        size_t accepts = 0;
+        size_t failures = 0;
+        std::vector<double> latencies_us;
+    };
+
+    const std::string request = "ping";
+    const std::string reply = "pong";
+
+    /**
+     * @brief Connect, write, wait for the first reply byte and disconnect, `count` times.
+     */
+    void churn(int port, int count, std::vector<double> &latencies, size_t &failures)
+    {
+        asio::io_context ioc;
+        const beauty::tcp_endpoint ep(beauty::address_v4::loopback(), port);
+        latencies.reserve(count);
+
+        for (int i = 0; i < count; ++i) {
+            beauty::error_code ec;
+            beauty::tcp::socket soc(ioc);
+            auto t0 = clock_type::now();
+            soc.connect(ep, ec);
+            if (!ec) {
+                asio::write(soc, asio::buffer(request), ec);
+            }
+            char first = 0;
+            if (!ec) {
+                soc.read_some(asio::buffer(&first, 1), ec);
+            }
+            auto t1 = clock_type::now();
+            if (ec) {
+                ++failures;
+                continue;
+            }
+            latencies.push_back(std::chrono::duration<double, std::micro>(t1 - t0).count());
+            soc.shutdown(beauty::tcp::socket::shutdown_both, ec);
+            soc.close(ec);
+        }
+    }
+
+    result run(int concurrency, int clients, int count, int base_port)
+    {
+        beauty::tcp_callback cb;
+        cb.on_read = [](beauty::tcp_session &sess, boost::asio::streambuf &, size_t) {
+            sess.write(reply, true);
+            return true;
+        };
+
+        result res;
+        res.clients = clients;
+        {
+            beauty::tcp_server server("churn_server");
+            server.concurrency(concurrency);
+            for (int c = 0; c < clients; ++c) {
+                server.listen(base_port + c, cb);
+            }
+
+            std::vector<std::vector<double>> latencies(clients);
+            std::vector<size_t> failures(clients, 0);
+            std::vector<std::thread> threads;
+
+            auto t0 = clock_type::now();
+            for (int c = 0; c < clients; ++c) {
+                threads.emplace_back([&, c] {
+                    churn(base_port + c, count, latencies[c], failures[c]);
+                });
+            }
+            for (auto &t : threads) {
+                t.join();
+            }
+            res.seconds = std::chrono::duration<double>(clock_type::now() - t0).count();
+
+            // Every successful iteration went through one accept within the timed window.
+            for (int c = 0; c < clients; ++c) {
+                res.failures += failures[c];
+                res.latencies_us.insert(
+                    res.latencies_us.end(), latencies[c].begin(), latencies[c].end());
+            }
+            res.accepts = res.latencies_us.size();
+
+            // Let the last sessions observe EOF before the server is torn down.
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        return res;
+    }
+
+    double percentile(std::vector<double> &v, double q)
+    {
+        if (v.empty()) {
+            return 0;
+        }
+        size_t n = std::min(v.size() - 1, static_cast<size_t>(q * v.size()));
+        std::nth_element(v.begin(), v.begin() + n, v.end());
+        return v[n];
+    }
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    int count = argc > 1 ? std::atoi(argv[1]) : 2000;
+    int per_worker = argc > 2 ? std::atoi(argv[2]) : 2;
+    int base_port = argc > 3 ? std::atoi(argv[3]) : 5680;
+
+    std::vector<int> levels;
+    for (int i = 4; i < argc; ++i) {
+        levels.push_back(std::atoi(argv[i]));
+    }
+    if (levels.empty()) {
+        levels = { 1, 2, 4, 8 };
+    }
+
+    std::printf("backend %s\n", beauty::application::backend());
+    std::printf("%-12s %8s %10s %12s %10s %10s %10s %10s %8s\n", "concurrency", "clients",
+        "accepts", "accepts/s", "p50(us)", "p90(us)", "p99(us)", "max(us)", "failed");
+    for (int level : levels) {
+        result res = run(level, per_worker * std::max(level, 1), count, base_port);
+        auto &l = res.latencies_us;
+        double p50 = percentile(l, 0.50);
+        double p90 = percentile(l, 0.90);
+        double p99 = percentile(l, 0.99);
+        double pmax = l.empty() ? 0 : *std::max_element(l.begin(), l.end());
+        std::printf("%-12d %8d %10zu %12.0f %10.1f %10.1f %10.1f %10.1f %8zu\n", level,
+            res.clients, res.accepts, res.accepts / res.seconds, p50, p90, p99, pmax, res.failures);
+    }
+    return 0;
+}
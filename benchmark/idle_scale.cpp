@@ -0,0 +1,297 @@
+/**
+ * @file idle_scale.cpp
+ * @brief Idle-connection scale harness and per-connection memory report for @ref
+ * beauty::tcp_server.
+ *
+ * A forked client process opens N concurrent connections to one `tcp_server`. An @ref
+ * beauty::acceptor serves one session at a time, so the server listens on N consecutive ports and
+ * each client connects to its own port; every connection then goes through the library's accept
+ * path and holds a real session: its `streambuf` (with the prepared read buffer), strand,
+ * `shared_ptr` control block and the callback it references. Once all the connections are
+ * established the server broadcasts one message through every acceptor.
+ *
+ * Reported:
+ *  - time to establish all the connections,
+ *  - server RSS growth per listening acceptor and per connection,
+ *  - broadcast latency (send timestamp to client receipt) p50/p99/max.
+ *
+ * The last line is a CSV record meant to be tracked over time. When `max bytes per conn` is given
+ * the program exits with status 1 if the measured footprint exceeds it, so it can gate regressions.
+ *
+ * Build (from the repository root, Linux only, verified with GCC 12 and Boost 1.74):
+ *      g++ -std=c++17 -O2 -Iinclude benchmark/idle_scale.cpp src/session.cpp -lpthread
+ *
+ * Usage:
+ *      idle_scale [connections] [concurrency] [base port] [max bytes per conn]
+ *
+ * The open file limit is raised to its hard limit; the server needs two descriptors per
+ * connection, so raise it beforehand (`ulimit -Hn`) for large runs. With one session per acceptor
+ * the number of connections is bounded by the free ports above `base port`.
+ */
+
+#include <beauty/beauty.hpp>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    using clock_type = std::chrono::steady_clock;
+
+    int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            clock_type::now().time_since_epoch())
+            .count();
+    }
+
+    size_t rss_bytes()
+    {
+        size_t pages = 0, resident = 0;
+        std::ifstream statm("/proc/self/statm");
+        statm >> pages >> resident;
+        return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    }
+
+    size_t raise_fd_limit()
+    {
+        rlimit rl{};
+        getrlimit(RLIMIT_NOFILE, &rl);
+        if (rl.rlim_cur < rl.rlim_max) {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+        return rl.rlim_cur;
+    }
+
+    void write_all(int fd, const void *data, size_t size)
+    {
+        auto p = static_cast<const char *>(data);
+        while (size > 0) {
+            ssize_t n = ::write(fd, p, size);
+            if (n <= 0) {
+                return;
+            }
+            p += n;
+            size -= static_cast<size_t>(n);
+        }
+    }
+
+    bool read_all(int fd, void *data, size_t size)
+    {
+        auto p = static_cast<char *>(data);
+        while (size > 0) {
+            ssize_t n = ::read(fd, p, size);
+            if (n <= 0) {
+                return false;
+            }
+            p += n;
+            size -= static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    struct client_report {
+        int64_t established_ns = 0;
+        size_t connected = 0;
+        size_t received = 0;
+        double p50_us = 0, p99_us = 0, max_us = 0;
+    };
+
+    // --------------------------------------------------------------------------
+    // Client process
+    // --------------------------------------------------------------------------
+
+    void run_clients(int base_port, size_t count, int report_fd, int control_fd)
+    {
+        asio::io_context ioc;
+        std::vector<beauty::tcp::socket> sockets;
+        sockets.reserve(count);
+
+        const size_t max_pending = 512;
+        size_t next = 0, pending = 0, connected = 0;
+        int64_t t0 = now_ns();
+
+        std::function<void()> launch = [&] {
+            while (next < count && pending < max_pending) {
+                int port = base_port + static_cast<int>(next++);
+                ++pending;
+                sockets.emplace_back(ioc);
+                sockets.back().async_connect(
+                    beauty::tcp_endpoint(beauty::address_v4::loopback(), port),
+                    [&](const beauty::error_code &ec) {
+                        --pending;
+                        if (!ec) {
+                            ++connected;
+                        }
+                        launch();
+                    });
+            }
+        };
+        launch();
+        ioc.run();
+
+        client_report rep;
+        rep.established_ns = now_ns() - t0;
+        rep.connected = connected;
+        write_all(report_fd, &rep, sizeof(rep));
+
+        // Wait for the broadcast on every connection.
+        std::vector<int64_t> stamps(sockets.size(), 0);
+        std::vector<double> latencies;
+        latencies.reserve(sockets.size());
+        ioc.restart();
+        for (size_t i = 0; i < sockets.size(); ++i) {
+            if (!sockets[i].is_open()) {
+                continue;
+            }
+            asio::async_read(sockets[i], asio::buffer(&stamps[i], sizeof(int64_t)),
+                [&, i](const beauty::error_code &ec, size_t) {
+                    if (!ec) {
+                        latencies.push_back((now_ns() - stamps[i]) / 1000.0);
+                    }
+                });
+        }
+        std::thread stopper([&] {
+            char c;
+            read_all(control_fd, &c, 1);
+            ioc.stop();
+        });
+        ioc.run();
+
+        rep.received = latencies.size();
+        if (!latencies.empty()) {
+            std::sort(latencies.begin(), latencies.end());
+            rep.p50_us = latencies[latencies.size() / 2];
+            rep.p99_us = latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+            rep.max_us = latencies.back();
+        }
+        write_all(report_fd, &rep, sizeof(rep));
+        stopper.join();
+    }
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+    int concurrency = argc > 2 ? std::atoi(argv[2]) : 1;
+    int base_port = argc > 3 ? std::atoi(argv[3]) : 20000;
+    size_t max_per_conn = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 0;
+
+    const size_t fds = raise_fd_limit();
+    const size_t allowed = std::min<size_t>(fds > 128 ? (fds - 128) / 2 : 0, 65535 - base_port);
+    if (allowed < count) {
+        std::fprintf(stderr, "open file limit and port range only allow %zu connections\n",
+            allowed);
+        count = allowed;
+    }
+
+    // Fork before the server exists, the client waits for a go byte.
+    int report[2], control[2];
+    if (pipe(report) != 0 || pipe(control) != 0) {
+        std::perror("pipe");
+        return 2;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(report[0]);
+        close(control[1]);
+        char go;
+        if (read_all(control[0], &go, 1)) {
+            run_clients(base_port, count, report[1], control[0]);
+        }
+        _exit(0);
+    }
+    close(report[1]);
+    close(control[0]);
+
+    std::atomic<size_t> accepted{ 0 };
+    beauty::tcp_callback cb;
+    cb.on_accepted = [&accepted](beauty::acceptor &, beauty::tcp_endpoint, beauty::tcp_endpoint) {
+        ++accepted;
+    };
+
+    client_report rep;
+    size_t rss_start = 0, rss_listen = 0, rss_connected = 0;
+    {
+        beauty::tcp_server server("scale_server");
+        server.concurrency(concurrency);
+
+        rss_start = rss_bytes();
+        for (size_t i = 0; i < count; ++i) {
+            server.listen(base_port + static_cast<int>(i), cb);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        rss_listen = rss_bytes();
+        write_all(control[1], "g", 1);
+
+        if (!read_all(report[0], &rep, sizeof(rep))) {
+            std::fprintf(stderr, "client process failed\n");
+            return 2;
+        }
+
+        // Wait until the server side has accepted every established connection.
+        auto deadline = clock_type::now() + std::chrono::seconds(30);
+        while (accepted < rep.connected && clock_type::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        rss_connected = rss_bytes();
+
+        // Broadcast, the payload is the send timestamp. Async writes refer to it until completion.
+        static beauty::buffer_type payload(sizeof(int64_t));
+        int64_t stamp = now_ns();
+        std::memcpy(payload.data(), &stamp, sizeof(stamp));
+        for (size_t i = 0; i < count; ++i) {
+            server.get_acceptor(base_port + static_cast<int>(i))->write(payload, true);
+        }
+
+        // Give the clients time to receive, then collect their report.
+        std::this_thread::sleep_for(std::chrono::milliseconds(std::max<size_t>(500, count / 20)));
+        write_all(control[1], "x", 1);
+        read_all(report[0], &rep, sizeof(rep));
+        waitpid(pid, nullptr, 0);
+
+        // Let the sessions observe EOF before the server is torn down.
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    const size_t n = std::max<size_t>(accepted, 1);
+    const size_t per_acceptor = (rss_listen - std::min(rss_start, rss_listen)) / std::max<size_t>(count, 1);
+    const size_t per_conn = (rss_connected - std::min(rss_listen, rss_connected)) / n;
+
+    std::printf("backend            : %s\n", beauty::application::backend());
+    std::printf("connections        : %zu requested, %zu connected, %zu accepted\n", count,
+        rep.connected, static_cast<size_t>(accepted));
+    std::printf("establish time     : %.1f ms\n", rep.established_ns / 1e6);
+    std::printf("server rss         : %.1f MiB idle, %.1f MiB listening, %.1f MiB connected\n",
+        rss_start / 1048576.0, rss_listen / 1048576.0, rss_connected / 1048576.0);
+    std::printf("rss per acceptor   : %zu bytes\n", per_acceptor);
+    std::printf("rss per connection : %zu bytes\n", per_conn);
+    std::printf("broadcast          : %zu received, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+        rep.received, rep.p50_us, rep.p99_us, rep.max_us);
+    std::printf("csv,connections,concurrency,establish_ms,rss_per_acceptor,rss_per_conn,"
+                "bcast_p50_us,bcast_p99_us,bcast_max_us,backend\n");
+    std::printf("csv,%zu,%d,%.1f,%zu,%zu,%.1f,%.1f,%.1f,%s\n", static_cast<size_t>(accepted),
+        concurrency, rep.established_ns / 1e6, per_acceptor, per_conn, rep.p50_us, rep.p99_us,
+        rep.max_us, beauty::application::backend());
+
+    if (max_per_conn && per_conn > max_per_conn) {
+        std::fprintf(stderr, "per-connection footprint %zu exceeds %zu bytes\n", per_conn,
+            max_per_conn);
+        return 1;
+    }
+    return 0;
+}
@@ -3,39 +3,58 @@
 #include <beauty/header.hpp>
 #include <beauty/application.hpp>
 #include <beauty/session.hpp>
+#include <beauty/trace.hpp>
 
 #include <boost/asio.hpp>
 
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <string>
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace asio = boost::asio;
 
 namespace beauty {
 
     //---------------------------------------------------------------------------
-    // Accepts incoming connections and launches the sessions
+    // Accepts incoming connections and launches the sessions, of a stream protocol: TCP or,
+    // with `local_stream`, Unix domain sockets. `acceptor` is the TCP one.
     //---------------------------------------------------------------------------
-    class acceptor : public std::enable_shared_from_this<acceptor> {
+    template <typename _Protocol>
+    class basic_acceptor : public std::enable_shared_from_this<basic_acceptor<_Protocol>> {
+
+        static_assert(is_stream<_Protocol>::value, "Only stream protocols accept connections");
 
-        using _Protocol = tcp;
         using cb_t = callback<_Protocol>;
         using edp_t = endpoint<_Protocol>;
         using sess_t = session<_Protocol>;
 
     public:
-        acceptor(application &app, const edp_t &endpoint, const cb_t &cb, int verbose)
+        basic_acceptor(application &app, const edp_t &endpoint, const cb_t &cb, int verbose,
+            const options &opt = {})
             : _app(app)
             , _endpoint(endpoint)
             , _acceptor(app.ioc())
             , _socket(app.ioc())
             , _callback(cb)
             , _verbose(verbose)
+            , _options(opt)
+            , _single(single_threaded::of(app.ioc()))
         {
             // NOTE: on_disconnected event will be replaced.
             _on_disconnected = _callback.on_disconnected;
             _callback.on_disconnected = [this](sess_t &sess, edp_t ep) {
                 _on_disconnected(sess, ep);
-                // Release the session.
+                // Release the session, keeping its latency.
+                std::lock_guard<std::mutex> lock(_session_mutex);
+                if (auto lat = sess.latency()) {
+                    _closed_latency.merge(lat->get());
+                }
                 this->_session.reset();
                 // Accept another connection on failed.
                 do_accept();
@@ -43,6 +62,9 @@ namespace beauty {
 
             boost::system::error_code ec;
 
+            // A socket file left by a previous run would fail the bind.
+            remove_stale_socket();
+
             // Open the acceptor
             _acceptor.open(endpoint.protocol(), ec);
             assert(!ec);
@@ -50,15 +72,18 @@ namespace beauty {
             // Bind to the server address
             _acceptor.bind(endpoint, ec);
             assert(!ec);
+            _bound = !ec;
 
             // Start listening for connections
             _acceptor.listen(asio::socket_base::max_listen_connections, ec);
             assert(!ec);
 
+            _manual = !opt.accept_loop;
+
             this->run();
         }
 
-        ~acceptor() { stop(); }
+        ~basic_acceptor() { stop(); }
 
         void run()
         {
@@ -70,8 +95,21 @@ namespace beauty {
 
         void stop()
         {
+            // Closing the session below runs `on_disconnected`, which must not accept again.
+            _stopping = true;
             if (_acceptor.is_open()) {
                 _acceptor.close();
+                remove_socket_file();
+            }
+            // Close the session now: its pending handlers may only be destroyed with the IO
+            // service, after this acceptor and the callback the session refers to.
+            std::shared_ptr<sess_t> sess;
+            {
+                std::lock_guard<std::mutex> lock(_session_mutex);
+                sess = _session;
+            }
+            if (sess) {
+                sess->close();
             }
         }
 
@@ -98,14 +136,76 @@ namespace beauty {
                 _session->read(async);
         }
 
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+        /**
+         * @brief Accept a connection in a coroutine:
+         *      `auto sess = co_await acceptor->async_accept();`
+         *      Listen with @ref options::accept_loop `false`. Otherwise the first call hands
+         *      the acceptor over by cancelling the callback driven accept loop, and connections
+         *      the loop took before still get its single session. Each accepted session is
+         *      owned by the caller, reads nothing on its own, and refers to the callbacks of
+         *      this acceptor, so must not outlive it. `on_accepted` is not called, a failure is
+         *      thrown as `boost::system::system_error`.
+         */
+        asio::awaitable<std::shared_ptr<sess_t>> async_accept()
+        {
+            auto me = this->shared_from_this();
+            if (!_manual.exchange(true)) {
+                error_code ecx;
+                _acceptor.cancel(ecx);
+            }
+            typename _Protocol::socket socket(_app.ioc());
+            error_code ec;
+            co_await _acceptor.async_accept(socket, asio::redirect_error(asio::use_awaitable, ec));
+            BEAUTY_PROBE2(accept, this, ec.value());
+            if (ec) {
+                BEAUTY_ERROR_RL(_verbose > 0, BEAUTY_ERROR_RATE, BEAUTY_ERROR_BURST,
+                    "Acception on " << _endpoint << " faild with error (" << ec.value()
+                                    << "): " << ec.message());
+                metrics::add(metric::accept_errors);
+                journal::record(journal_event::accept, 0, 0, ec.value());
+                throw boost::system::system_error(ec);
+            }
+            auto sess = std::make_shared<sess_t>(
+                _app.ioc(), std::move(socket), _callback, _verbose, _options);
+            sess->_is_connnected = true;
+            metrics::add(metric::accepts);
+            journal::record(journal_event::accept, sess->id(), 0, 0);
+            metrics::add(metric::active_sessions);
+            co_return sess;
+        }
+#endif
+
         void do_accept()
         {
+            if (_manual || _stopping) {
+                return; // Accepted by coroutines, or stopped.
+            }
+            if (_single && !_app.ioc().get_executor().running_in_this_thread()) {
+                // No per-socket lock in the reactor: start the accept on the IO thread.
+                asio::post(_app.ioc(), [this]() { do_accept(); });
+                return;
+            }
             BEAUTY_INFO(true, "Start acception on " << _endpoint);
             _acceptor.async_accept(_socket, [this](auto ec) { this->on_accept(ec); });
         }
 
         const edp_t get_endpoint() const { return _endpoint; };
 
+        /**
+         * @brief Latency of all the sessions served so far, including the current one.
+         * @note Empty unless the acceptor was made with @ref options::latency.
+         */
+        latency_snapshot latency() const
+        {
+            std::lock_guard<std::mutex> lock(_session_mutex);
+            latency_snapshot snap = _closed_latency;
+            if (_session && _session->latency()) {
+                snap.merge(_session->latency()->get());
+            }
+            return snap;
+        }
+
     protected:
         void on_accept(error_code ec)
         {
@@ -113,19 +213,25 @@ namespace beauty {
             auto ep = _acceptor.local_endpoint(ecx);
             auto epr = _socket.remote_endpoint(ecx);
 
-            if (ec == boost::system::errc::operation_canceled) {
+            if (ec == boost::system::errc::operation_canceled || _stopping) {
                 BEAUTY_INFO(_verbose > 0,
                     "Acception on " << ep << " canceled (" << ec.value() << "): " << ec.message());
                 return; // Nothing to do anymore
             }
 
             BEAUTY_INFO(true, "Accepted connection from " << epr);
+            BEAUTY_PROBE2(accept, this, ec.value());
+            metrics::add(metric::handler_invocations);
+            BEAUTY_PROBE2(callback_entry, this, static_cast<int>(probe_on_accepted));
             _callback.on_accepted(*this, ep, epr);
+            BEAUTY_PROBE2(callback_exit, this, static_cast<int>(probe_on_accepted));
 
             if (ec) {
-                BEAUTY_ERROR(_verbose > 0,
+                BEAUTY_ERROR_RL(_verbose > 0, BEAUTY_ERROR_RATE, BEAUTY_ERROR_BURST,
                     "Acception on " << ep << " faild with error (" << ec.value()
                                     << "): " << ec.message());
+                metrics::add(metric::accept_errors);
+                journal::record(journal_event::accept, 0, 0, ec.value());
                 _app.stop();
             } else {
 
@@ -136,11 +242,16 @@ namespace beauty {
 
                     if (!_session) {
                         BEAUTY_INFO(_verbose > 0, "Make session on " << ep << " for " << epr);
-                        _session = std::make_shared<sess_t>(
-                            _app.ioc(), std::move(_socket), _callback, _verbose);
+                        auto sess = std::make_shared<sess_t>(
+                            _app.ioc(), std::move(_socket), _callback, _verbose, _options);
+                        std::lock_guard<std::mutex> lock(_session_mutex);
+                        _session = std::move(sess);
                     }
 
                     _session->_is_connnected = true;
+                    metrics::add(metric::accepts);
+                    journal::record(journal_event::accept, _session->id(), 0, 0);
+                    metrics::add(metric::active_sessions);
                     _session->read(true);
                     // Return on connection succeeded.
                     return;
@@ -161,14 +272,56 @@ namespace beauty {
         }
 
     private:
+        // Unlink the socket file of a previous run: a socket nobody listens on anymore, never a
+        // live one nor any other file.
+        void remove_stale_socket()
+        {
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+            if constexpr (std::is_same<_Protocol, local_stream>::value) {
+                const std::string path = _endpoint.path();
+                struct stat st;
+                if (path.empty() || path[0] == '\0' || ::lstat(path.c_str(), &st) != 0
+                    || !S_ISSOCK(st.st_mode)) {
+                    return; // Abstract, missing, or not a socket: the bind reports it.
+                }
+                error_code ec;
+                typename _Protocol::socket probe(_app.ioc());
+                probe.connect(_endpoint, ec);
+                if (ec == asio::error::connection_refused) {
+                    ::unlink(path.c_str());
+                }
+            }
+#endif
+        }
+
+        // Unlink the socket file this acceptor is bound to.
+        void remove_socket_file()
+        {
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+            if constexpr (std::is_same<_Protocol, local_stream>::value) {
+                const std::string path = _endpoint.path();
+                if (_bound && !path.empty() && path[0] != '\0') {
+                    ::unlink(path.c_str());
+                }
+            }
+#endif
+        }
+
         application &_app;
-        tcp::acceptor _acceptor;
-        tcp::socket _socket;
+        typename _Protocol::acceptor _acceptor;
+        typename _Protocol::socket _socket;
         const edp_t _endpoint;
         std::shared_ptr<sess_t> _session;
         cb_t _callback;
         const int _verbose;
+        const options _options;
         std::function<void(sess_t &, edp_t)> _on_disconnected;
+        mutable std::mutex _session_mutex;
+        latency_snapshot _closed_latency;
+        std::atomic<bool> _manual{ false }; ///< Accepting with @ref async_accept.
+        std::atomic<bool> _stopping{ false };
+        bool _bound = false; ///< The socket file, if any, is ours.
+        const bool _single;
     };
 
 } // namespace beauty
@@ -1,10 +1,13 @@
 #pragma once
 
 #include <beauty/header.hpp>
+#include <beauty/metrics.hpp>
+#include <beauty/timer.hpp>
 
 #include <boost/asio.hpp>
 #include <boost/optional.hpp>
 
+#include <chrono>
 #include <vector>
 #include <thread>
 #include <optional>
@@ -13,16 +16,44 @@
 namespace asio = boost::asio;
 
 namespace beauty {
-    class timer;
+
+    /**
+     * @brief How the worker threads wait for events, see @ref application::polling.
+     */
+    enum class run_mode {
+        block, ///< Sleep in the reactor until an event. [Default]
+        busy_poll, ///< Spin on non-blocking polls: lowest wakeup latency, one core per worker.
+        hybrid, ///< Spin for a while after the last event, then sleep until the next one.
+    };
+
+    /**
+     * @brief Threads running an @ref application.
+     */
+    enum class threading {
+        multi, ///< Any `concurrency`, sessions serialized by strands. [Default]
+        /**
+         * One IO thread, `concurrency` is ignored. The io_context drops its per-socket locks
+         * (`BOOST_ASIO_CONCURRENCY_HINT_UNSAFE_IO`) and sessions their strands. Posting,
+         * stopping, timers and async writes stay safe from other threads, every other
+         * session call must be made on the IO thread, e.g. from the callbacks.
+         */
+        single,
+    };
 
     // --------------------------------------------------------------------------
     class application {
     public:
-        application(std::string name)
+        application(std::string name, threading mode = threading::multi)
             : _name(name)
+            , _ioc(mode == threading::single ? BOOST_ASIO_CONCURRENCY_HINT_UNSAFE_IO
+                                             : BOOST_ASIO_CONCURRENCY_HINT_DEFAULT)
             , _work(asio::make_work_guard(_ioc))
             , _state(State::waiting)
+            , _single(mode == threading::single)
         {
+            if (_single) {
+                asio::use_service<single_threaded>(_ioc);
+            }
         }
         ~application() { stop(); }
 
@@ -48,9 +79,10 @@ namespace beauty {
                 _ioc.restart();
             }
             _state = State::started;
+            BEAUTY_INFO(true, "Start " << _name << " on " << backend());
 
             // Run the I/O service on the requested number of threads
-            _threads.resize(concurrency > 1 ? concurrency : 1);
+            _threads.resize(concurrency > 1 && !_single ? concurrency : 1);
             _active_threads = 0;
             for (auto &t : _threads) {
                 ++_active_threads;
@@ -60,10 +92,11 @@ namespace beauty {
 #endif
                     for (;;) {
                         try {
-                            _ioc.run();
+                            work();
                             break;
                         } catch (const std::exception &ex) {
                             BEAUTY_ERROR(true, "worker error: " << ex.what());
+                            metrics::add(metric::worker_exceptions);
                         }
                     }
                     --_active_threads;
@@ -101,7 +134,20 @@ namespace beauty {
             _state = State::started;
 
             // Run
-            _ioc.run();
+            work();
+        }
+
+        /**
+         * @brief Set how the event loop waits for events, before it is started.
+         * @param mode See @ref run_mode. Spinning modes are meant for dedicated cores, pair them
+         *      with @ref options::busy_poll to also spin in the kernel socket receive path.
+         * @param spin For @ref run_mode::hybrid, the time to keep spinning after the last
+         *      handler ran.
+         */
+        void polling(run_mode mode, std::chrono::microseconds spin = std::chrono::microseconds(100))
+        {
+            _mode = mode;
+            _spin = spin;
         }
 
         /**
@@ -120,6 +166,7 @@ namespace beauty {
          */
         void post(std::function<void()> work)
         {
+            metrics::add(metric::posted_tasks);
             boost::asio::post(_ioc.get_executor(), std::move(work));
         }
 
@@ -151,7 +198,66 @@ namespace beauty {
          */
         asio::io_context &ioc() { return _ioc; }
 
+        /**
+         * @brief Access the timer wheel of the IO service.
+         */
+        timer &timers() { return timer::get(_ioc); }
+
+        /**
+         * @brief Event demultiplexer the IO service was built on: "io_uring" with
+         *      `USING_IO_URING`, "io_uring+epoll" when asio uses io_uring for files only,
+         *      "epoll", "kqueue", "/dev/poll", "iocp" or "select".
+         */
+        static const char *backend()
+        {
+#if defined(BOOST_ASIO_HAS_IO_URING_AS_DEFAULT)
+            return "io_uring";
+#elif defined(BOOST_ASIO_HAS_IO_URING) && defined(BOOST_ASIO_HAS_EPOLL)
+            return "io_uring+epoll";
+#elif defined(BOOST_ASIO_HAS_IOCP)
+            return "iocp";
+#elif defined(BOOST_ASIO_HAS_EPOLL)
+            return "epoll";
+#elif defined(BOOST_ASIO_HAS_KQUEUE)
+            return "kqueue";
+#elif defined(BOOST_ASIO_HAS_DEV_POLL)
+            return "/dev/poll";
+#else
+            return "select";
+#endif
+        }
+
     private:
+        // Run handlers until stopped, waiting for events as set by @ref polling.
+        void work()
+        {
+            switch (_mode) {
+            case run_mode::block:
+                _ioc.run();
+                break;
+            case run_mode::busy_poll:
+                // The reactor is polled with a zero timeout, never sleeping in epoll_wait.
+                while (!_ioc.stopped()) {
+                    _ioc.poll();
+                }
+                break;
+            case run_mode::hybrid: {
+                using clock_type = std::chrono::steady_clock;
+                auto last = clock_type::now();
+                while (!_ioc.stopped()) {
+                    if (_ioc.poll()) {
+                        last = clock_type::now();
+                    } else if (clock_type::now() - last >= _spin) {
+                        // Quiet for a while: sleep until the next event, then spin again.
+                        _ioc.run_one();
+                        last = clock_type::now();
+                    }
+                }
+                break;
+            }
+            }
+        }
+
         const std::string _name;
 
         asio::io_context _ioc;
@@ -162,6 +268,10 @@ namespace beauty {
         enum class State { waiting, started, stopped };
         std::atomic<State> _state{ State::waiting }; // Three State allows a good ioc.restart
         std::atomic<int> _active_threads{ 0 }; // std::barrier in C++20
+
+        const bool _single;
+        run_mode _mode = run_mode::block;
+        std::chrono::microseconds _spin{ 100 };
     };
 
 } // namespace beauty
@@ -0,0 +1,515 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifndef BEAUTY_ASYNC_LOG_SLOTS
+#define BEAUTY_ASYNC_LOG_SLOTS 2048 // Records per thread ring, 240 bytes each.
+#endif
+
+namespace beauty {
+
+    // --------------------------------------------------------------------------
+    // Asynchronous logging backend
+    // --------------------------------------------------------------------------
+    //
+    // Selected with `USING_LOG` and `USING_ASYNC_LOG`. A log statement does not format anything:
+    // it writes a compact record, the call site (file, line, level) plus the raw streamed
+    // arguments, into a per-thread SPSC ring. A background thread formats the records and writes
+    // them in batches. When a ring is full the record is dropped and counted, the calling thread
+    // never blocks.
+    //
+    // Strings are copied (truncated to the record capacity), but string literals marked with
+    // `BEAUTY_LITERAL("...")`, which are stored by address. Integers, floating points, booleans
+    // and IP endpoints are stored raw. Any other streamable type is formatted on the calling
+    // thread.
+
+    enum class log_level : uint8_t { info, error };
+
+    /**
+     * @brief A string with static storage, see `BEAUTY_LITERAL`.
+     */
+    struct log_literal {
+        const char *s;
+    };
+
+// Only a string literal compiles: `""` concatenates with it.
+#define BEAUTY_LITERAL(s) (beauty::log_literal{ "" s })
+
+    /**
+     * @brief One log statement, fixed size.
+     */
+    struct log_record {
+        static constexpr size_t capacity = 216;
+
+        const char *file;
+        uint32_t line;
+        log_level level;
+        uint16_t size;
+        int64_t time_ns;
+        uint8_t data[capacity];
+    };
+
+    /**
+     * @brief Single producer single consumer ring of records, one per logging thread.
+     */
+    class log_ring {
+    public:
+        static constexpr size_t slots = BEAUTY_ASYNC_LOG_SLOTS;
+        static_assert((slots & (slots - 1)) == 0, "BEAUTY_ASYNC_LOG_SLOTS must be a power of two");
+
+        /**
+         * @return Number of records queued after the push, `slots + 1` if dropped.
+         */
+        size_t push(const log_record &rec)
+        {
+            size_t head = _head.load(std::memory_order_relaxed);
+            size_t queued = head - _tail.load(std::memory_order_acquire);
+            if (queued == slots) {
+                _dropped.store(
+                    _dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return slots + 1;
+            }
+            std::memcpy(&_records[head & (slots - 1)], &rec,
+                offsetof(log_record, data) + rec.size);
+            _head.store(head + 1, std::memory_order_release);
+            return queued + 1;
+        }
+
+        template <typename F>
+        size_t drain(F &&f)
+        {
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            size_t head = _head.load(std::memory_order_acquire);
+            for (size_t i = tail; i != head; ++i) {
+                f(_records[i & (slots - 1)]);
+            }
+            _tail.store(head, std::memory_order_release);
+            return head - tail;
+        }
+
+        uint64_t take_dropped() { return _dropped.exchange(0, std::memory_order_relaxed); }
+
+        std::atomic<bool> orphan{ false }; // Its thread exited.
+
+    private:
+        alignas(64) std::atomic<size_t> _head{ 0 };
+        alignas(64) std::atomic<size_t> _tail{ 0 };
+        std::atomic<uint64_t> _dropped{ 0 };
+        std::array<log_record, slots> _records;
+    };
+
+    /**
+     * @brief Background formatter and writer.
+     */
+    class async_logger {
+        enum tag : uint8_t { t_int, t_uint, t_double, t_bool, t_char, t_static, t_string, t_v4, t_v6 };
+
+    public:
+        static async_logger &instance()
+        {
+            static async_logger logger;
+            return logger;
+        }
+
+        /**
+         * @brief Write to a file instead of stderr.
+         * @return false if it cannot be opened.
+         */
+        bool open(const std::string &path)
+        {
+            FILE *f = std::fopen(path.c_str(), "a");
+            if (!f) {
+                return false;
+            }
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_out != stderr) {
+                std::fclose(_out);
+            }
+            _out = f;
+            return true;
+        }
+
+        void push(const log_record &rec)
+        {
+            size_t queued = local().push(rec);
+            // Wake the writer early on errors or when the ring fills up.
+            if (rec.level == log_level::error || queued == log_ring::slots / 2) {
+                _wake.notify_one();
+            }
+        }
+
+        /**
+         * @brief Format and write everything pushed so far (blocking).
+         */
+        void flush()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            write_all();
+        }
+
+        ~async_logger()
+        {
+            _running = false;
+            _wake.notify_one();
+            if (_thread.joinable()) {
+                _thread.join();
+            }
+            flush();
+            if (_out != stderr) {
+                std::fclose(_out);
+            }
+        }
+
+        // Argument encoding, used by @ref log_line.
+        static bool put(log_record &rec, tag t, const void *p, size_t n)
+        {
+            if (rec.size + 1 + n > log_record::capacity) {
+                return false;
+            }
+            rec.data[rec.size] = t;
+            std::memcpy(rec.data + rec.size + 1, p, n);
+            rec.size = static_cast<uint16_t>(rec.size + 1 + n);
+            return true;
+        }
+
+        static void put_string(log_record &rec, const char *s, size_t n)
+        {
+            size_t room = log_record::capacity - rec.size;
+            if (room < 3) {
+                return;
+            }
+            n = n < room - 3 ? n : room - 3;
+            uint16_t len = static_cast<uint16_t>(n);
+            rec.data[rec.size] = t_string;
+            std::memcpy(rec.data + rec.size + 1, &len, 2);
+            std::memcpy(rec.data + rec.size + 3, s, n);
+            rec.size = static_cast<uint16_t>(rec.size + 3 + n);
+        }
+
+        static void put_static(log_record &rec, const char *s) { put(rec, t_static, &s, sizeof(s)); }
+        static void put_int(log_record &rec, int64_t v) { put(rec, t_int, &v, sizeof(v)); }
+        static void put_uint(log_record &rec, uint64_t v) { put(rec, t_uint, &v, sizeof(v)); }
+        static void put_double(log_record &rec, double v) { put(rec, t_double, &v, sizeof(v)); }
+        static void put_bool(log_record &rec, bool v) { put(rec, t_bool, &v, 1); }
+        static void put_char(log_record &rec, char v) { put(rec, t_char, &v, 1); }
+
+        static void put_address(log_record &rec, const boost::asio::ip::address &addr, uint16_t port)
+        {
+            if (addr.is_v4()) {
+                uint8_t raw[6];
+                auto bytes = addr.to_v4().to_bytes();
+                std::memcpy(raw, bytes.data(), 4);
+                std::memcpy(raw + 4, &port, 2);
+                put(rec, t_v4, raw, sizeof(raw));
+            } else {
+                uint8_t raw[18];
+                auto bytes = addr.to_v6().to_bytes();
+                std::memcpy(raw, bytes.data(), 16);
+                std::memcpy(raw + 16, &port, 2);
+                put(rec, t_v6, raw, sizeof(raw));
+            }
+        }
+
+    private:
+        async_logger()
+            : _thread([this] { run(); })
+        {
+        }
+
+        // Hands the ring over to the writer when its thread exits.
+        struct ring_handle {
+            std::shared_ptr<log_ring> ring = std::make_shared<log_ring>();
+            ~ring_handle() { ring->orphan = true; }
+        };
+
+        log_ring &local()
+        {
+            thread_local ring_handle h;
+            thread_local bool registered = false;
+            if (!registered) {
+                registered = true;
+                std::lock_guard<std::mutex> lock(_rings_mutex);
+                _rings.push_back(h.ring);
+            }
+            return *h.ring;
+        }
+
+        void run()
+        {
+            while (_running) {
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _wake.wait_for(lock, std::chrono::milliseconds(10));
+                    write_all();
+                }
+            }
+        }
+
+        // Called with _mutex held.
+        void write_all()
+        {
+            std::vector<std::shared_ptr<log_ring>> rings;
+            {
+                std::lock_guard<std::mutex> lock(_rings_mutex);
+                rings = _rings;
+            }
+            std::vector<log_ring *> drained;
+            _batch.clear();
+            for (auto &ring : rings) {
+                // An orphan does not push anymore, it is empty once drained.
+                bool orphan = ring->orphan;
+                ring->drain([this](const log_record &rec) { format(rec); });
+                if (uint64_t dropped = ring->take_dropped()) {
+                    _batch += "[async_log] " + std::to_string(dropped)
+                        + " records dropped, ring full\n";
+                }
+                if (orphan) {
+                    drained.push_back(ring.get());
+                }
+            }
+            if (!_batch.empty()) {
+                std::fwrite(_batch.data(), 1, _batch.size(), _out);
+                std::fflush(_out);
+            }
+            // Forget the rings of exited threads.
+            if (!drained.empty()) {
+                std::lock_guard<std::mutex> lock(_rings_mutex);
+                for (auto r : drained) {
+                    for (auto it = _rings.begin(); it != _rings.end(); ++it) {
+                        if (it->get() == r) {
+                            _rings.erase(it);
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        void format(const log_record &rec)
+        {
+            char head[96];
+            const char *file = std::strrchr(rec.file, '/');
+            file = file ? file + 1 : rec.file;
+            std::snprintf(head, sizeof(head), "%10.3f %s %s:%u| ", rec.time_ns / 1e9,
+                rec.level == log_level::error ? "ERR " : "INFO", file, rec.line);
+            _batch += head;
+
+            size_t i = 0;
+            while (i < rec.size) {
+                uint8_t t = rec.data[i++];
+                const uint8_t *p = rec.data + i;
+                switch (t) {
+                case t_int: {
+                    int64_t v;
+                    std::memcpy(&v, p, 8);
+                    _batch += std::to_string(v);
+                    i += 8;
+                    break;
+                }
+                case t_uint: {
+                    uint64_t v;
+                    std::memcpy(&v, p, 8);
+                    _batch += std::to_string(v);
+                    i += 8;
+                    break;
+                }
+                case t_double: {
+                    double v;
+                    std::memcpy(&v, p, 8);
+                    std::ostringstream os;
+                    os << v;
+                    _batch += os.str();
+                    i += 8;
+                    break;
+                }
+                case t_bool:
+                    _batch += *p ? "1" : "0";
+                    i += 1;
+                    break;
+                case t_char:
+                    _batch += static_cast<char>(*p);
+                    i += 1;
+                    break;
+                case t_static: {
+                    const char *s;
+                    std::memcpy(&s, p, sizeof(s));
+                    _batch += s;
+                    i += sizeof(s);
+                    break;
+                }
+                case t_string: {
+                    uint16_t len;
+                    std::memcpy(&len, p, 2);
+                    _batch.append(reinterpret_cast<const char *>(p + 2), len);
+                    i += 2 + len;
+                    break;
+                }
+                case t_v4:
+                case t_v6: {
+                    const size_t n = t == t_v4 ? 4 : 16;
+                    uint16_t port;
+                    std::memcpy(&port, p + n, 2);
+                    if (t == t_v4) {
+                        boost::asio::ip::address_v4::bytes_type b;
+                        std::memcpy(b.data(), p, 4);
+                        _batch += boost::asio::ip::address_v4(b).to_string();
+                    } else {
+                        boost::asio::ip::address_v6::bytes_type b;
+                        std::memcpy(b.data(), p, 16);
+                        _batch += "[" + boost::asio::ip::address_v6(b).to_string() + "]";
+                    }
+                    _batch += ":" + std::to_string(port);
+                    i += n + 2;
+                    break;
+                }
+                default:
+                    i = rec.size;
+                    break;
+                }
+            }
+            _batch += '\n';
+        }
+
+        std::mutex _mutex; // Writer side: output and batch.
+        std::condition_variable _wake;
+        FILE *_out = stderr;
+        std::string _batch;
+
+        std::mutex _rings_mutex;
+        std::vector<std::shared_ptr<log_ring>> _rings;
+
+        std::atomic<bool> _running{ true };
+        std::thread _thread;
+    };
+
+    /**
+     * @brief Collects the streamed arguments of one log statement, pushes the record when
+     *      destroyed at the end of the statement.
+     */
+    class log_line {
+    public:
+        log_line(log_level level, const char *file, unsigned line)
+        {
+            _rec.file = file;
+            _rec.line = line;
+            _rec.level = level;
+            _rec.size = 0;
+            _rec.time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch())
+                               .count();
+        }
+        ~log_line() { async_logger::instance().push(_rec); }
+
+        log_line(const log_line &) = delete;
+        log_line &operator=(const log_line &) = delete;
+
+        // Stored by address, it outlives the record.
+        log_line &operator<<(log_literal s)
+        {
+            async_logger::put_static(_rec, s.s);
+            return *this;
+        }
+
+        // A literal or any char array, a stack buffer as well: copied, up to its size.
+        template <size_t N>
+        log_line &operator<<(const char (&s)[N])
+        {
+            async_logger::put_string(_rec, s, strnlen(s, N));
+            return *this;
+        }
+
+        template <typename T>
+        typename std::enable_if<std::is_same<T, const char *>::value
+                || std::is_same<T, char *>::value,
+            log_line &>::type
+        operator<<(T s)
+        {
+            async_logger::put_string(_rec, s, std::strlen(s));
+            return *this;
+        }
+
+        log_line &operator<<(const std::string &s)
+        {
+            async_logger::put_string(_rec, s.data(), s.size());
+            return *this;
+        }
+
+        log_line &operator<<(const void *p)
+        {
+            async_logger::put_uint(_rec, reinterpret_cast<uintptr_t>(p));
+            return *this;
+        }
+
+        log_line &operator<<(bool v)
+        {
+            async_logger::put_bool(_rec, v);
+            return *this;
+        }
+
+        log_line &operator<<(char v)
+        {
+            async_logger::put_char(_rec, v);
+            return *this;
+        }
+
+        template <typename T>
+        typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value
+                && !std::is_same<T, char>::value,
+            log_line &>::type
+        operator<<(T v)
+        {
+            if (std::is_signed<T>::value) {
+                async_logger::put_int(_rec, static_cast<int64_t>(v));
+            } else {
+                async_logger::put_uint(_rec, static_cast<uint64_t>(v));
+            }
+            return *this;
+        }
+
+        template <typename T>
+        typename std::enable_if<std::is_floating_point<T>::value, log_line &>::type operator<<(
+            T v)
+        {
+            async_logger::put_double(_rec, static_cast<double>(v));
+            return *this;
+        }
+
+        template <typename P>
+        log_line &operator<<(const boost::asio::ip::basic_endpoint<P> &ep)
+        {
+            async_logger::put_address(_rec, ep.address(), ep.port());
+            return *this;
+        }
+
+        // Anything else is formatted here.
+        template <typename T>
+        typename std::enable_if<!std::is_arithmetic<T>::value && !std::is_pointer<T>::value
+                && !std::is_array<T>::value && !std::is_same<T, std::string>::value,
+            log_line &>::type
+        operator<<(const T &v)
+        {
+            std::ostringstream os;
+            os << v;
+            return *this << os.str();
+        }
+
+    private:
+        log_record _rec;
+    };
+
+} // namespace beauty
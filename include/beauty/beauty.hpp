@@ -10,8 +10,12 @@
 #include <beauty/application.hpp>
 #include <beauty/client.hpp>
 #include <beauty/header.hpp>
+#include <beauty/histogram.hpp>
+#include <beauty/metrics.hpp>
 #include <beauty/server.hpp>
 #include <beauty/session.hpp>
+#include <beauty/stats.hpp>
+#include <beauty/streamer.hpp>
 
 namespace beauty {
 
@@ -27,4 +31,18 @@ namespace beauty {
     using udp_client = client<udp>;
     using udp_session = session<udp>;
 
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    // Unix domain stream socket interface, `local_server` in server.hpp
+    using local_endpoint = endpoint<local_stream>;
+    using local_callback = callback<local_stream>;
+    using local_client = client<local_stream>;
+    using local_session = session<local_stream>;
+
+    // Unix domain datagram socket interface
+    using local_datagram_endpoint = endpoint<local_datagram>;
+    using local_datagram_callback = callback<local_datagram>;
+    using local_datagram_client = client<local_datagram>;
+    using local_datagram_session = session<local_datagram>;
+#endif
+
 } // namespace beauty
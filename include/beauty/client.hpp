@@ -1,6 +1,7 @@
 #pragma once
 
 #include <beauty/header.hpp>
+#include <beauty/application.hpp>
 #include <beauty/session.hpp>
 
 #include <boost/asio.hpp>
@@ -21,8 +22,8 @@ namespace beauty {
         using sess_t = session<_Protocol>;
 
     public:
-        client(std::string name = "client")
-            : _app(name)
+        client(std::string name = "client", threading mode = threading::multi)
+            : _app(name, mode)
         {
         }
         ~client() { stop(); }
@@ -33,17 +34,29 @@ namespace beauty {
         client(client &&) = default;
         client &operator=(client &&) = default;
 
+        /**
+         * @brief How the IO thread waits for events, see @ref application::polling.
+         */
+        client &polling(
+            run_mode mode, std::chrono::microseconds spin = std::chrono::microseconds(100))
+        {
+            _app.polling(mode, spin);
+            return *this;
+        }
+
         /**
          * @brief Start a connection for TCP.
          * @param port Remote endpoint's port.
          * @param addr Remote endpoint's address.
          * @param cb See alse @ref connect.
          * @param verbose See alse @ref connect.
+         * @param opt See alse @ref connect.
          * @return client&
          */
-        client &connect(int port, std::string addr, const cb_t &cb = {}, int verbose = 0)
+        client &connect(int port, std::string addr, const cb_t &cb = {}, int verbose = 0,
+            const options &opt = {})
         {
-            return connect(port, address_v4::from_string(addr), cb, verbose);
+            return connect(port, address_v4::from_string(addr), cb, verbose, opt);
         }
 
         /**
@@ -52,11 +65,13 @@ namespace beauty {
          * @param addr Remote endpoint's address.
          * @param cb See alse @ref connect.
          * @param verbose See alse @ref connect.
+         * @param opt See alse @ref connect.
          * @return client&
          */
-        client &connect(int port, address_v4 addr = {}, const cb_t &cb = {}, int verbose = 0)
+        client &connect(int port, address_v4 addr = {}, const cb_t &cb = {}, int verbose = 0,
+            const options &opt = {})
         {
-            return connect(edp_t(addr, port), cb, verbose);
+            return connect(edp_t(addr, port), cb, verbose, opt);
         }
 
         /**
@@ -64,16 +79,17 @@ namespace beauty {
          * @param ep Target remote endpoint.
          * @param cb Callback on the connection.
          * @param verbose Verbose for the session of the connection.
+         * @param opt Options for the session of the connection.
          * @return client&
          */
-        client &connect(edp_t ep, const cb_t &cb = {}, int verbose = 0)
+        client &connect(edp_t ep, const cb_t &cb = {}, int verbose = 0, const options &opt = {})
         {
             try {
                 if (!_app.is_started()) {
                     _app.start();
                 }
                 if (!_session) {
-                    _session = std::make_shared<sess_t>(_app.ioc(), cb, verbose);
+                    _session = std::make_shared<sess_t>(_app.ioc(), cb, verbose, opt);
                 }
                 _session->connect(ep);
 
@@ -87,23 +103,92 @@ namespace beauty {
             return *this;
         }
 
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
         /**
-         * @brief Start a receiving for UDP.
+         * @brief Make connection in a coroutine: `co_await client.async_connect(ep);`
+         *      See @ref session::async_connect.
          * @param ep Target remote endpoint.
+         * @param cb Callback on the connection, must outlive the session.
+         * @param verbose Verbose for the session of the connection.
+         * @param opt Options for the session of the connection.
+         */
+        asio::awaitable<void> async_connect(
+            edp_t ep, const cb_t &cb, int verbose = 0, const options &opt = {})
+        {
+            if (!_app.is_started()) {
+                _app.start();
+            }
+            if (!_session) {
+                _session = std::make_shared<sess_t>(_app.ioc(), cb, verbose, opt);
+            }
+            return _session->async_connect(ep);
+        }
+
+        /**
+         * @brief Make connection in a coroutine, without callbacks nor options.
+         * @note Not a defaulted `opt`: GCC destroys the default arguments of a call awaited in
+         *      a coroutine twice.
+         */
+        asio::awaitable<void> async_connect(edp_t ep) { return async_connect(ep, no_callback()); }
+
+        /**
+         * @brief Read some data in a coroutine, see @ref session::async_read.
+         */
+        asio::awaitable<size_t> async_read(asio::mutable_buffer buffer)
+        {
+            auto sess = _session;
+            if (!sess) {
+                throw boost::system::system_error(asio::error::not_connected);
+            }
+            co_return co_await sess->async_read(buffer);
+        }
+
+        /**
+         * @brief Write some data in a coroutine, see @ref session::async_write.
+         */
+        asio::awaitable<size_t> async_write(asio::const_buffer buffer)
+        {
+            auto sess = _session;
+            if (!sess) {
+                throw boost::system::system_error(asio::error::not_connected);
+            }
+            co_return co_await sess->async_write(buffer);
+        }
+#endif
+
+        /**
+         * @brief Start a receiving for UDP.
+         * @param port Local port to receive on.
          * @param cb Callback on the connection.
          * @param verbose Verbose for the session of the connection.
+         * @param opt Options for the session of the connection.
          * @return client&
          */
-        client &receive(int port, const callback<udp> &cb = {}, bool async = true, int verbose = 0)
+        client &receive(int port, const callback<udp> &cb = {}, bool async = true, int verbose = 0,
+            const options &opt = {})
+        {
+            return receive(edp_t(address_v4(), port), cb, async, verbose, opt);
+        }
+
+        /**
+         * @brief Start a receiving for a datagram protocol, e.g. on a socket path for
+         *      `local_datagram`.
+         * @param ep Local endpoint to receive on.
+         * @param cb Callback on the connection.
+         * @param verbose Verbose for the session of the connection.
+         * @param opt Options for the session of the connection.
+         * @return client&
+         */
+        client &receive(edp_t ep, const cb_t &cb, bool async = true, int verbose = 0,
+            const options &opt = {})
         {
             try {
                 if (!_app.is_started()) {
                     _app.start();
                 }
                 if (!_session) {
-                    _session = std::make_shared<sess_t>(_app.ioc(), cb, verbose);
+                    _session = std::make_shared<sess_t>(_app.ioc(), cb, verbose, opt);
                 }
-                endpoint<udp> ep(address_v4(), port);
                 _session->receive(ep, async);
 
             } catch (const boost::system::system_error &e) {
@@ -140,9 +225,14 @@ namespace beauty {
         }
 
         /**
-         * @brief Destroy current session.
+         * @brief Close and destroy current session, a pending reconnection is cancelled.
          */
-        void close() { _session.reset(); }
+        void close()
+        {
+            if (_session)
+                _session->close();
+            _session.reset();
+        }
 
         /**
          * @brief Run the application's IO service (blocking).
@@ -162,7 +252,29 @@ namespace beauty {
         const application &app() const { return _app; }
         bool is_connnected() const { return _session && _session->is_connnected(); }
 
+        /**
+         * @brief Latency of the current session.
+         * @note Empty unless connected with @ref options::latency.
+         */
+        latency_snapshot latency() const
+        {
+            return _session && _session->latency() ? _session->latency()->get()
+                                                   : latency_snapshot();
+        }
+
+        /**
+         * @brief Current session, nullptr before connecting.
+         */
+        const std::shared_ptr<sess_t> &get_session() const { return _session; }
+
     private:
+        // Callbacks of the sessions connected without any, they never go out of scope.
+        static const cb_t &no_callback()
+        {
+            static const cb_t cb;
+            return cb;
+        }
+
         application _app;
         std::shared_ptr<sess_t> _session;
     };
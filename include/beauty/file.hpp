@@ -0,0 +1,91 @@
+#pragma once
+
+#include <beauty/header.hpp>
+
+#include <cstdint>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace beauty {
+
+    // --------------------------------------------------------------------------
+    // File transmission
+    // --------------------------------------------------------------------------
+
+    /**
+     * @brief Region of a file still to be sent, queued by @ref session::send_file. Closes the
+     *      file once destroyed, if it opened it.
+     */
+    struct file_region {
+        int fd = -1;
+        uint64_t offset = 0;
+        uint64_t left = 0; ///< Bytes to send from `offset`.
+        bool owned = false;
+
+        file_region() = default;
+        file_region(const file_region &) = delete;
+        file_region &operator=(const file_region &) = delete;
+
+        ~file_region()
+        {
+#ifndef _WIN32
+            if (owned && fd >= 0) {
+                ::close(fd);
+            }
+#endif
+        }
+
+        /**
+         * @brief Open `path` read only, see @ref assign.
+         */
+        error_code open(const std::string &path, uint64_t from, uint64_t length)
+        {
+#ifndef _WIN32
+            int f = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (f < 0) {
+                return error_code(errno, boost::system::system_category());
+            }
+            return assign(f, from, length, true);
+#else
+            (void)path;
+            (void)from;
+            (void)length;
+            return boost::asio::error::operation_not_supported;
+#endif
+        }
+
+        /**
+         * @brief Send `length` bytes of `f` from `from`, up to its end if `length` is 0 or
+         *      beyond it.
+         * @param own Close `f` once destroyed.
+         */
+        error_code assign(int f, uint64_t from, uint64_t length, bool own)
+        {
+            fd = f;
+            owned = own;
+#ifndef _WIN32
+            struct stat st;
+            if (::fstat(f, &st) != 0) {
+                return error_code(errno, boost::system::system_category());
+            }
+            const uint64_t size = static_cast<uint64_t>(st.st_size);
+            offset = from;
+            left = from < size ? size - from : 0;
+            if (length && length < left) {
+                left = length;
+            }
+            return {};
+#else
+            (void)from;
+            (void)length;
+            return boost::asio::error::operation_not_supported;
+#endif
+        }
+    };
+
+} // namespace beauty
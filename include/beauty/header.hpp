@@ -1,12 +1,40 @@
 #pragma once
 
+#include <chrono>
 #include <vector>
 #include <string>
 #include <functional>
+#include <type_traits>
+#include <utility> // Before asio: its coroutine support uses std::exchange.
+
+// io_uring backend (Linux, Boost 1.78 or later, link with -luring): build everything with
+// USING_IO_URING=1, the io_context then runs its sockets, timers and posts on io_uring instead
+// of epoll. See @ref application::backend.
+#if defined(USING_IO_URING) && USING_IO_URING
+#include <boost/version.hpp>
+#if BOOST_VERSION < 107800
+#error "USING_IO_URING needs Boost.Asio 1.78 or later"
+#endif
+#ifndef BOOST_ASIO_HAS_IO_URING
+#define BOOST_ASIO_HAS_IO_URING 1
+#endif
+#ifndef BOOST_ASIO_DISABLE_EPOLL
+#define BOOST_ASIO_DISABLE_EPOLL 1
+#endif
+#endif
+
 #include <boost/asio.hpp>
 
 #if defined(USING_LOG) && USING_LOG
-#ifdef USING_LOGURU
+#if defined(USING_ASYNC_LOG) && USING_ASYNC_LOG
+#include "async_log.hpp"
+#define BEAUTY_INFO(cond, x)                                                                      \
+    ((cond) ? (void)(beauty::log_line(beauty::log_level::info, __FILE__, __LINE__) << x)         \
+            : (void)0);
+#define BEAUTY_ERROR(cond, x)                                                                     \
+    ((cond) ? (void)(beauty::log_line(beauty::log_level::error, __FILE__, __LINE__) << x)        \
+            : (void)0);
+#elif defined(USING_LOGURU)
 #include "loguru/loguru.hpp"
 #define BEAUTY_INFO(cond, x)  VLOG_IF_S(loguru::Verbosity_INFO, cond) << x;
 #define BEAUTY_ERROR(cond, x) VLOG_IF_S(loguru::Verbosity_ERROR, cond) << x;
@@ -20,6 +48,70 @@
 #define BEAUTY_ERROR(cond, x) (void)0;
 #endif
 
+// A string literal in a log statement: the async backend stores it by address, not copied.
+#ifndef BEAUTY_LITERAL
+#define BEAUTY_LITERAL(s) ("" s)
+#endif
+
+// Highest verbose level compiled in. Statements of a higher level (per-packet ones are level 2)
+// compile to nothing, so release builds do not even check the runtime verbose.
+#ifndef BEAUTY_MAX_VERBOSE
+#ifdef NDEBUG
+#define BEAUTY_MAX_VERBOSE 1
+#else
+#define BEAUTY_MAX_VERBOSE 2
+#endif
+#endif
+
+// Log when the runtime `verbose` reaches `level`, and `level` is compiled in.
+#define BEAUTY_VINFO(level, verbose, x)                                                           \
+    do {                                                                                          \
+        if constexpr ((level) <= beauty::max_verbose) {                                           \
+            BEAUTY_INFO((verbose) >= (level), x)                                                  \
+        }                                                                                         \
+    } while (0)
+
+// Error logging for storms (reconnect loops, broken peers): every call site owns its own limiter,
+// and the number of dropped messages is appended to the next message emitted from that site, or
+// logged alone once the site is quiet, see @ref log_flusher.
+#if defined(USING_LOG) && USING_LOG
+#include "log_limit.hpp"
+// At most `rate` messages per second, after a burst of `burst` messages.
+#define BEAUTY_ERROR_RL(cond, rate, burst, x)                                                     \
+    do {                                                                                          \
+        if (cond) {                                                                               \
+            static beauty::log_rate_limiter beauty_limiter_(                                      \
+                (rate), (burst), __FILE__, __LINE__);                                             \
+            uint64_t beauty_suppressed_ = 0;                                                      \
+            if (beauty_limiter_.admit(beauty_suppressed_)) {                                      \
+                BEAUTY_ERROR(true, x << beauty::log_suppressed{ beauty_suppressed_ })             \
+            }                                                                                     \
+        }                                                                                         \
+    } while (0)
+// One message out of `n`.
+#define BEAUTY_ERROR_SAMPLED(cond, n, x)                                                          \
+    do {                                                                                          \
+        if (cond) {                                                                               \
+            static beauty::log_sampler beauty_sampler_((n));                                      \
+            uint64_t beauty_suppressed_ = 0;                                                      \
+            if (beauty_sampler_.admit(beauty_suppressed_)) {                                      \
+                BEAUTY_ERROR(true, x << beauty::log_suppressed{ beauty_suppressed_ })             \
+            }                                                                                     \
+        }                                                                                         \
+    } while (0)
+#else
+#define BEAUTY_ERROR_RL(cond, rate, burst, x) (void)0
+#define BEAUTY_ERROR_SAMPLED(cond, n, x)      (void)0
+#endif
+
+// Limits of the library's own IO error messages.
+#ifndef BEAUTY_ERROR_RATE
+#define BEAUTY_ERROR_RATE 10
+#endif
+#ifndef BEAUTY_ERROR_BURST
+#define BEAUTY_ERROR_BURST 20
+#endif
+
 #ifndef __FUNCTION_NAME__
 #ifdef WIN32 // WINDOWS
 #define __FUNCTION_NAME__ __FUNCTION__
@@ -30,20 +122,170 @@
 
 namespace beauty {
 
+    constexpr int max_verbose = BEAUTY_MAX_VERBOSE;
+
     using buffer_type = std::vector<uint8_t>;
     using address_v4 = boost::asio::ip::address_v4;
     using error_code = boost::system::error_code;
     using tcp = boost::asio::ip::tcp;
     using udp = boost::asio::ip::udp;
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    // Unix domain sockets, for peers on the same host.
+    using local_stream = boost::asio::local::stream_protocol;
+    using local_datagram = boost::asio::local::datagram_protocol;
+#endif
 
     template <typename _Protocol>
     using endpoint = typename _Protocol::endpoint;
 
+    /**
+     * @brief Connection oriented protocols, served by @ref basic_acceptor and read as a byte
+     *      stream. The others are datagram ones, like UDP.
+     */
+    template <typename _Protocol>
+    struct is_stream : std::false_type {
+    };
+    template <>
+    struct is_stream<tcp> : std::true_type {
+    };
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    template <>
+    struct is_stream<local_stream> : std::true_type {
+    };
+#endif
+
+    // --------------------------------------------------------------------------
+    // Session options
+    // --------------------------------------------------------------------------
+
+    struct options {
+        /**
+         * @brief Record read, write and user callback durations into per-session histograms.
+         * @note See @ref session::latency.
+         */
+        bool latency = false;
+
+        /**
+         * @brief Limits of the async write queue, 0 disables a limit.
+         *      Reaching a high watermark (queued bytes or messages) calls
+         *      @ref callback::on_write_backpressure with `true`, then falling back to the low
+         *      watermark of every enabled limit calls it with `false`.
+         */
+        size_t write_high_watermark = 0; ///< Bytes.
+        size_t write_low_watermark = 0; ///< Bytes.
+        size_t write_high_messages = 0;
+        size_t write_low_messages = 0;
+
+        /**
+         * @brief Stop re-arming reads while the write queue is over its high watermark.
+         */
+        bool pause_read_on_backpressure = false;
+
+        /**
+         * @brief Ingress and egress bandwidth limits in bytes per second, 0 for unlimited.
+         *      A session over its read rate re-arms its next async read later with a timer,
+         *      instead of reading data it would have to hold. Async writes wait the same way.
+         *      Sync reads and writes are not limited.
+         * @note Given to @ref tcp_server::listen, the limits apply to each accepted session.
+         */
+        double read_rate = 0;
+        double read_burst = 0; ///< Bytes, one second of `read_rate` if 0.
+        double write_rate = 0;
+        double write_burst = 0; ///< Bytes, one second of `write_rate` if 0.
+
+        /**
+         * @brief Deadlines of an async session, 0 disables them. On expiry
+         *      @ref callback::on_timeout decides to close the session or to wait again.
+         *      Checked on the @ref timer wheel, so precise to the wheel tick.
+         */
+        std::chrono::milliseconds idle_timeout{ 0 }; ///< No read nor write completed.
+        std::chrono::milliseconds read_timeout{ 0 }; ///< An async read armed and no data.
+        std::chrono::milliseconds write_timeout{ 0 }; ///< An async write pending, no progress.
+
+        /**
+         * @brief Client reconnection, when @ref callback::on_connect_failed returns `true`.
+         *      The n-th retry waits `min_delay * multiplier^(n-1)`, capped to `max_delay`, minus
+         *      a random part of up to `jitter` of it, on the @ref timer wheel.
+         */
+        struct reconnect_policy {
+            std::chrono::milliseconds min_delay{ 100 };
+            std::chrono::milliseconds max_delay{ 30000 };
+            double multiplier = 2;
+            double jitter = 0.2; ///< In [0, 1].
+            unsigned max_attempts = 0; ///< Retries after a failure, 0 for no limit.
+        } reconnect;
+
+        /**
+         * @brief Application-level keepalive of an async session, checked on the
+         *      @ref timer wheel with the timeouts. After `interval` without any write, `payload`
+         *      is written. Any data read counts as the answer, once `missed` pings are left
+         *      unanswered @ref callback::on_timeout is called with `timeout_kind::heartbeat`.
+         * @note Answers are only seen while an async read is armed.
+         */
+        struct heartbeat_policy {
+            std::chrono::milliseconds interval{ 0 }; ///< 0 disables the heartbeat.
+            std::string payload = "PING";
+            unsigned missed = 3;
+        } heartbeat;
+
+        /**
+         * @brief `SO_BUSY_POLL` of the session socket (Linux), 0 to leave it: a blocked or
+         *      polled receive spins this long in the driver for packets instead of waiting for
+         *      an interrupt. Raising it over `net.core.busy_read` needs `CAP_NET_ADMIN`.
+         * @note Pairs with the spinning @ref run_mode of @ref application::polling.
+         */
+        std::chrono::microseconds busy_poll{ 0 };
+
+        /**
+         * @brief Accept in a callback driven loop. `false` for an acceptor only served by
+         *      coroutines, see @ref acceptor::async_accept.
+         * @note Acceptor ONLY.
+         */
+        bool accept_loop = true;
+
+        /**
+         * @brief Async TCP writes of at least this many bytes are sent with `MSG_ZEROCOPY`
+         *      (Linux 4.14), 0 disables it. The kernel sends from the buffer itself instead of
+         *      copying it, the message completes once the socket error queue confirms the kernel
+         *      released it. Only the writes whose buffer lifetime the session knows qualify: the
+         *      moved in buffers and the writes with a completion token. Below some 10 KB the
+         *      page pinning costs more than the copy.
+         */
+        size_t zerocopy_threshold = 0;
+    };
+
+    enum class timeout_kind { idle, read, write, heartbeat };
+
+    /**
+     * @brief Service marking an io_context run by a single thread, see @ref threading. Its
+     *      sessions use the io_context executor instead of a strand.
+     */
+    class single_threaded : public boost::asio::io_context::service {
+    public:
+        inline static boost::asio::io_context::id id;
+
+        explicit single_threaded(boost::asio::io_context &ioc)
+            : boost::asio::io_context::service(ioc)
+        {
+        }
+
+        static bool of(boost::asio::io_context &ioc)
+        {
+            return boost::asio::has_service<single_threaded>(ioc);
+        }
+
+    private:
+        void shutdown() override {}
+    };
+
     // --------------------------------------------------------------------------
     // Callback interface
     // --------------------------------------------------------------------------
 
-    class acceptor;
+    template <typename _Protocol>
+    class basic_acceptor;
+
+    using acceptor = basic_acceptor<tcp>;
 
     template <typename _Protocol>
     class session;
@@ -53,6 +295,9 @@ namespace beauty {
 
         using edp_t = endpoint<_Protocol>;
         using sess_t = session<_Protocol>;
+        // Datagram protocols accept nothing, they keep the TCP acceptor of old.
+        using accep_t
+            = std::conditional_t<is_stream<_Protocol>::value, basic_acceptor<_Protocol>, acceptor>;
 
     public:
         /**
@@ -62,7 +307,7 @@ namespace beauty {
          * @param edp_t Remote endpoint.
          * @note Server ONLY.
          */
-        std::function<void(acceptor &, edp_t, edp_t)> on_accepted = [](acceptor &, edp_t, edp_t) {};
+        std::function<void(accep_t &, edp_t, edp_t)> on_accepted = [](accep_t &, edp_t, edp_t) {};
 
         /**
          * @brief Callback on client connection succeeded.
@@ -76,7 +321,7 @@ namespace beauty {
          * @brief Callback on client connection failed.
          * @param sess_t Current session.
          * @note Client ONLY.
-         *      return `true` to try connect again.
+         *      return `true` to try connect again, after the @ref options::reconnect delay.
          *      return `false` to close the session. [Default]
          */
         std::function<bool(sess_t &, edp_t, error_code)> on_connect_failed
@@ -106,6 +351,24 @@ namespace beauty {
         std::function<bool(sess_t &, error_code)> on_write_failed
             = [](sess_t &, error_code) { return false; };
 
+        /**
+         * @brief Callback on the async write queue crossing a watermark, see @ref options.
+         * @param sess_t Current session.
+         * @param bool `true` when over the high watermark, `false` when back to the low one.
+         * @param size_t Bytes queued.
+         */
+        std::function<void(sess_t &, bool, size_t)> on_write_backpressure
+            = [](sess_t &, bool, size_t) {};
+
+        /**
+         * @brief Callback on a session deadline expired, see @ref options::idle_timeout.
+         *      return `true` to keep the session and wait a full timeout again.
+         *      return `false` to close the session. [Default]
+         * @param sess_t Current session.
+         */
+        std::function<bool(sess_t &, timeout_kind)> on_timeout
+            = [](sess_t &, timeout_kind) { return false; };
+
         /**
          * @brief Callback on read some data.
          *      return `true` to try read (async) again. [Default]
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace beauty {
+
+    // --------------------------------------------------------------------------
+    // Log-linear histogram
+    // --------------------------------------------------------------------------
+
+    /**
+     * @brief Lock-free log-linear histogram of durations in nanoseconds.
+     *      Every power of two is split in 8 linear sub-buckets (12.5% precision), values from
+     *      2^40 ns (~18 minutes) on are clamped to the last bucket. Recording is two relaxed
+     *      atomic additions, reading is done through a @ref snapshot.
+     */
+    class histogram {
+    public:
+        static constexpr unsigned sub_bits = 3;
+        static constexpr unsigned max_exp = 40;
+        static constexpr size_t bucket_count = size_t(max_exp - sub_bits + 1) << sub_bits;
+
+        /**
+         * @brief Plain copy of a histogram, can be merged and queried.
+         */
+        struct snapshot {
+            std::array<uint64_t, bucket_count> counts{};
+            uint64_t count = 0;
+            uint64_t sum = 0;
+
+            /**
+             * @brief Value under which a ratio `q` (in [0, 1]) of the samples are.
+             * @return The upper bound of the bucket holding that sample, 0 if empty.
+             */
+            uint64_t percentile(double q) const
+            {
+                if (count == 0) {
+                    return 0;
+                }
+                uint64_t rank = static_cast<uint64_t>(q * static_cast<double>(count));
+                rank = rank < count ? rank + 1 : count;
+                uint64_t seen = 0;
+                for (size_t i = 0; i < bucket_count; ++i) {
+                    seen += counts[i];
+                    if (seen >= rank) {
+                        return upper_bound(i);
+                    }
+                }
+                return upper_bound(bucket_count - 1);
+            }
+
+            uint64_t mean() const { return count ? sum / count : 0; }
+
+            uint64_t max() const
+            {
+                for (size_t i = bucket_count; i-- > 0;) {
+                    if (counts[i]) {
+                        return upper_bound(i);
+                    }
+                }
+                return 0;
+            }
+
+            snapshot &merge(const snapshot &other)
+            {
+                for (size_t i = 0; i < bucket_count; ++i) {
+                    counts[i] += other.counts[i];
+                }
+                count += other.count;
+                sum += other.sum;
+                return *this;
+            }
+        };
+
+        histogram() = default;
+        histogram(const histogram &) = delete;
+        histogram &operator=(const histogram &) = delete;
+
+        /**
+         * @brief Record one value.
+         * @param ns Duration in nanoseconds.
+         */
+        void record(uint64_t ns) noexcept
+        {
+            _counts[index(ns)].fetch_add(1, std::memory_order_relaxed);
+            _sum.fetch_add(ns, std::memory_order_relaxed);
+        }
+
+        snapshot get() const
+        {
+            snapshot s;
+            for (size_t i = 0; i < bucket_count; ++i) {
+                s.counts[i] = _counts[i].load(std::memory_order_relaxed);
+                s.count += s.counts[i];
+            }
+            s.sum = _sum.load(std::memory_order_relaxed);
+            return s;
+        }
+
+        /**
+         * @brief Bucket of a value.
+         */
+        static size_t index(uint64_t v) noexcept
+        {
+            if (v < (uint64_t(1) << sub_bits)) {
+                return static_cast<size_t>(v);
+            }
+            unsigned e = log2(v);
+            if (e >= max_exp) {
+                return bucket_count - 1;
+            }
+            return (size_t(e - sub_bits + 1) << sub_bits)
+                + static_cast<size_t>((v >> (e - sub_bits)) & ((1u << sub_bits) - 1));
+        }
+
+        /**
+         * @brief Smallest value of a bucket.
+         */
+        static uint64_t lower_bound(size_t i) noexcept
+        {
+            if (i < (size_t(1) << sub_bits)) {
+                return i;
+            }
+            unsigned e = static_cast<unsigned>(i >> sub_bits) + sub_bits - 1;
+            uint64_t m = (uint64_t(1) << sub_bits) + (i & ((size_t(1) << sub_bits) - 1));
+            return m << (e - sub_bits);
+        }
+
+        /**
+         * @brief Smallest value of the next bucket, i.e. the exclusive upper bound.
+         */
+        static uint64_t upper_bound(size_t i) noexcept
+        {
+            if (i < (size_t(1) << sub_bits)) {
+                return i + 1;
+            }
+            unsigned e = static_cast<unsigned>(i >> sub_bits) + sub_bits - 1;
+            return lower_bound(i) + (uint64_t(1) << (e - sub_bits));
+        }
+
+    private:
+        static unsigned log2(uint64_t v) noexcept
+        {
+#ifdef _MSC_VER
+            unsigned long r;
+            _BitScanReverse64(&r, v);
+            return static_cast<unsigned>(r);
+#else
+            return 63u - static_cast<unsigned>(__builtin_clzll(v));
+#endif
+        }
+
+        std::array<std::atomic<uint64_t>, bucket_count> _counts{};
+        std::atomic<uint64_t> _sum{ 0 };
+    };
+
+    // --------------------------------------------------------------------------
+    // Session latency
+    // --------------------------------------------------------------------------
+
+    /**
+     * @brief Durations recorded by a session, see @ref options::latency.
+     */
+    struct latency_histograms {
+        histogram read; ///< Async read armed to its completion, or a sync read.
+        histogram write; ///< Async write armed to its completion, or a sync write.
+        histogram callback; ///< User `on_read`/`on_write` callback invocation.
+
+        struct snapshot {
+            histogram::snapshot read;
+            histogram::snapshot write;
+            histogram::snapshot callback;
+
+            snapshot &merge(const snapshot &other)
+            {
+                read.merge(other.read);
+                write.merge(other.write);
+                callback.merge(other.callback);
+                return *this;
+            }
+        };
+
+        snapshot get() const { return { read.get(), write.get(), callback.get() }; }
+    };
+
+    using latency_snapshot = latency_histograms::snapshot;
+
+} // namespace beauty
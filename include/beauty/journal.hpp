@@ -0,0 +1,197 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifndef USING_JOURNAL
+#define USING_JOURNAL 1
+#endif
+
+namespace beauty {
+
+    // --------------------------------------------------------------------------
+    // Connection event journal
+    // --------------------------------------------------------------------------
+
+    enum class journal_event : uint8_t {
+        accept = 1, ///< `session` is the accepted session, 0 on failure.
+        connect,
+        read, ///< `size` is the bytes read.
+        write, ///< `size` is the bytes written.
+        close,
+    };
+
+    /**
+     * @brief One fixed-size journal entry.
+     */
+    struct journal_record {
+        uint64_t time; ///< steady_clock, in nanoseconds.
+        uint64_t session; ///< @ref session::id.
+        uint32_t size;
+        int32_t error; ///< error_code value, 0 on success.
+        uint32_t seq; ///< Low bits of the record number plus one, written last.
+        uint8_t event; ///< @ref journal_event.
+        uint8_t reserved[3];
+    };
+    static_assert(sizeof(journal_record) == 32, "journal_record must stay 32 bytes");
+
+    /**
+     * @brief Head of a journal file, followed by `capacity` records.
+     */
+    struct journal_header {
+        static constexpr char signature[8] = { 'B', 'E', 'A', 'U', 'T', 'Y', 'J', '1' };
+
+        char magic[8];
+        uint32_t record_size;
+        uint32_t reserved;
+        uint64_t capacity;
+        uint64_t steady_origin; ///< steady_clock at open, in nanoseconds.
+        uint64_t system_origin; ///< system_clock at open, in nanoseconds since the epoch.
+        std::atomic<uint64_t> head; ///< Records written since open, the ring wraps at capacity.
+        uint64_t padding[2];
+    };
+    static_assert(sizeof(journal_header) == 64, "journal_header must stay 64 bytes");
+
+    /**
+     * @brief Process wide binary recorder of session events into a memory-mapped ring file.
+     *
+     * Writers claim a slot with one atomic increment and fill it in place, so recording is a
+     * few stores into the page cache and nothing is lost if the process dies. The file is
+     * decoded offline by `tools/journal_decode.cpp`. Until @ref open is called, recording is
+     * a single relaxed load. POSIX only, @ref open fails elsewhere.
+     */
+    class journal {
+    public:
+        static journal &instance()
+        {
+            // Never destroyed, IO threads may still record during static destruction.
+            static journal *j = new journal();
+            return *j;
+        }
+
+        /**
+         * @brief Start recording into a file, truncated to hold `capacity` records.
+         * @return False if the file could not be created or mapped.
+         */
+        bool open(const std::string &path, uint64_t capacity = uint64_t(1) << 20)
+        {
+#ifndef _WIN32
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (capacity == 0) {
+                return false;
+            }
+            int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                return false;
+            }
+            size_t length = sizeof(journal_header) + capacity * sizeof(journal_record);
+            if (::ftruncate(fd, static_cast<off_t>(length)) != 0) {
+                ::close(fd);
+                return false;
+            }
+            void *addr = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (addr == MAP_FAILED) {
+                return false;
+            }
+
+            auto h = new (addr) journal_header();
+            std::memcpy(h->magic, journal_header::signature, sizeof(h->magic));
+            h->record_size = sizeof(journal_record);
+            h->capacity = capacity;
+            h->steady_origin = now();
+            h->system_origin = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch())
+                    .count());
+
+            close_locked();
+            _length = length;
+            _header.store(h, std::memory_order_release);
+            return true;
+#else
+            (void)path;
+            (void)capacity;
+            return false;
+#endif
+        }
+
+        /**
+         * @brief Stop recording and flush the file. The mapping itself is only released at
+         *      exit, so a writer racing with close never touches unmapped memory.
+         */
+        void close()
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            close_locked();
+        }
+
+        bool is_open() const { return _header.load(std::memory_order_relaxed) != nullptr; }
+
+        /**
+         * @brief Append one record, no-op when closed.
+         */
+        static void record(journal_event ev, uint64_t session, uint64_t size, int error) noexcept
+        {
+#if USING_JOURNAL
+            journal_header *h = instance()._header.load(std::memory_order_acquire);
+            if (!h) {
+                return;
+            }
+            uint64_t n = h->head.fetch_add(1, std::memory_order_relaxed);
+            auto r = reinterpret_cast<journal_record *>(h + 1) + (n % h->capacity);
+            r->seq = 0;
+            r->time = now();
+            r->session = session;
+            r->size = size > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(size);
+            r->error = error;
+            r->event = static_cast<uint8_t>(ev);
+            std::atomic_thread_fence(std::memory_order_release);
+            r->seq = static_cast<uint32_t>(n + 1);
+#else
+            (void)ev;
+            (void)session;
+            (void)size;
+            (void)error;
+#endif
+        }
+
+    private:
+        journal() = default;
+
+        static uint64_t now() noexcept
+        {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch())
+                                             .count());
+        }
+
+        void close_locked()
+        {
+            journal_header *h = _header.exchange(nullptr, std::memory_order_acq_rel);
+#ifndef _WIN32
+            if (h) {
+                ::msync(h, _length, MS_ASYNC);
+            }
+#else
+            (void)h;
+#endif
+        }
+
+        std::mutex _mutex;
+        std::atomic<journal_header *> _header{ nullptr };
+        size_t _length = 0;
+    };
+
+} // namespace beauty
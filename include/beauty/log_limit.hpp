@@ -0,0 +1,260 @@
+#pragma once
+
+#include <beauty/metrics.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#ifndef BEAUTY_SUPPRESSED_FLUSH_MS
+#define BEAUTY_SUPPRESSED_FLUSH_MS 1000 // Quiet time before a suppressed count is logged alone.
+#endif
+
+namespace beauty {
+
+    // --------------------------------------------------------------------------
+    // Log rate limiting
+    // --------------------------------------------------------------------------
+
+    /**
+     * @brief Number of messages dropped at a call site since its previous emitted message,
+     *      printed as a ` (N suppressed)` suffix, or nothing when zero.
+     */
+    struct log_suppressed {
+        uint64_t count;
+    };
+
+    inline std::ostream &operator<<(std::ostream &os, const log_suppressed &s)
+    {
+        if (s.count) {
+            os << " (" << s.count << " suppressed)";
+        }
+        return os;
+    }
+
+    /**
+     * @brief Suppressed count of one log call site, shared by its limiter and the
+     *      @ref log_flusher, so either may go first.
+     */
+    struct log_site {
+        log_site(const char *f, unsigned l)
+            : file(f)
+            , line(l)
+        {
+        }
+
+        const char *const file;
+        const unsigned line;
+        std::atomic<int64_t> admitted{ 0 }; ///< Time of the last admitted message.
+        std::atomic<uint64_t> suppressed{ 0 };
+        bool watched = false; ///< Under the flusher lock.
+    };
+
+    /**
+     * @brief Logs the suppressed counts that no admitted message carried, as a line of their
+     *      own: once a storm stops, no message comes to report its tail. A call site is watched
+     *      from its first suppressed message until its count is reported, by one thread that
+     *      only wakes every `BEAUTY_SUPPRESSED_FLUSH_MS` while some site is watched. What is
+     *      left is flushed at exit.
+     */
+    class log_flusher {
+    public:
+        static log_flusher &instance()
+        {
+            static log_flusher flusher;
+            return flusher;
+        }
+
+        ~log_flusher()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _running = false;
+            }
+            _wake.notify_one();
+            if (_thread.joinable()) {
+                _thread.join();
+            }
+        }
+
+        void watch(const std::shared_ptr<log_site> &site)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (site->watched || !_running) {
+                    return;
+                }
+                site->watched = true;
+                _sites.push_back(site);
+                if (!_thread.joinable()) {
+                    _thread = std::thread([this]() { run(); });
+                }
+            }
+            _wake.notify_one();
+        }
+
+    private:
+        log_flusher() = default;
+
+        static int64_t now_ns()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
+
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (_running) {
+                if (_sites.empty()) {
+                    _wake.wait(lock);
+                    continue;
+                }
+                _wake.wait_for(lock, std::chrono::milliseconds(BEAUTY_SUPPRESSED_FLUSH_MS));
+                lock.unlock();
+                flush(false);
+                lock.lock();
+            }
+            // On this thread: the exiting main thread may have released its log ring already.
+            lock.unlock();
+            flush(true);
+        }
+
+        // Log the counts of the sites quiet for a flush period, all of them at exit.
+        void flush(bool all)
+        {
+            const int64_t quiet = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::milliseconds(BEAUTY_SUPPRESSED_FLUSH_MS))
+                                      .count();
+            const int64_t now = now_ns();
+            std::vector<std::pair<std::shared_ptr<log_site>, uint64_t>> counts;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                auto it = std::remove_if(_sites.begin(), _sites.end(), [&](const auto &site) {
+                    if (!all && now - site->admitted.load(std::memory_order_relaxed) < quiet) {
+                        return false; // The next admitted message may still carry it.
+                    }
+                    // Taken once: either here or by an admitted message.
+                    uint64_t n = site->suppressed.exchange(0, std::memory_order_relaxed);
+                    if (n) {
+                        counts.emplace_back(site, n);
+                        return false; // Unwatched at the next round if still quiet.
+                    }
+                    site->watched = false;
+                    return true;
+                });
+                _sites.erase(it, _sites.end());
+            }
+            for (auto &count : counts) {
+                const log_site &site = *count.first;
+                BEAUTY_ERROR(*site.file, site.file << ":" << site.line << ": " << count.second
+                                                   << " messages suppressed")
+                BEAUTY_ERROR(!*site.file, count.second << " messages suppressed")
+            }
+        }
+
+        std::mutex _mutex;
+        std::condition_variable _wake;
+        std::vector<std::shared_ptr<log_site>> _sites;
+        bool _running = true;
+        std::thread _thread;
+    };
+
+    /**
+     * @brief Lock-free token bucket of one log call site, see @ref BEAUTY_ERROR_RL.
+     *      Implemented as a generic cell rate algorithm: a single atomic holds the theoretical
+     *      arrival time of the next message, so concurrent IO threads only race on one CAS.
+     *      The messages dropped at the end of a storm are reported by the @ref log_flusher.
+     */
+    class log_rate_limiter {
+    public:
+        /**
+         * @param rate Messages per second allowed in the long run.
+         * @param burst Messages allowed back to back before the rate applies.
+         * @param file Call site, for the counts reported alone.
+         * @param line Call site line.
+         */
+        log_rate_limiter(double rate, unsigned burst, const char *file = "", unsigned line = 0)
+            : _interval(static_cast<int64_t>(1e9 / (rate > 0 ? rate : 1)))
+            , _tolerance(_interval * static_cast<int64_t>(burst > 0 ? burst - 1 : 0))
+            , _site(std::make_shared<log_site>(file, line))
+        {
+        }
+
+        /**
+         * @brief Take a token.
+         * @param suppressed Set to the messages dropped since the previous admitted one.
+         * @return Whether the message should be emitted.
+         */
+        bool admit(uint64_t &suppressed) noexcept
+        {
+            const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch())
+                                    .count();
+            int64_t tat = _tat.load(std::memory_order_relaxed);
+            for (;;) {
+                int64_t start = tat > now ? tat : now;
+                if (start - now > _tolerance) {
+                    if (_site->suppressed.fetch_add(1, std::memory_order_relaxed) == 0) {
+                        try {
+                            log_flusher::instance().watch(_site);
+                        } catch (...) {
+                            // No thread: only reported by the next admitted message.
+                        }
+                    }
+                    metrics::add(metric::logs_suppressed);
+                    return false;
+                }
+                if (_tat.compare_exchange_weak(
+                        tat, start + _interval, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            _site->admitted.store(now, std::memory_order_relaxed);
+            suppressed = _site->suppressed.exchange(0, std::memory_order_relaxed);
+            return true;
+        }
+
+    private:
+        const int64_t _interval;
+        const int64_t _tolerance;
+        std::atomic<int64_t> _tat{ 0 };
+        const std::shared_ptr<log_site> _site;
+    };
+
+    /**
+     * @brief 1-in-N sampler of one log call site, see @ref BEAUTY_ERROR_SAMPLED.
+     */
+    class log_sampler {
+    public:
+        explicit log_sampler(unsigned n)
+            : _n(n > 0 ? n : 1)
+        {
+        }
+
+        bool admit(uint64_t &suppressed) noexcept
+        {
+            uint64_t i = _seen.fetch_add(1, std::memory_order_relaxed);
+            if (i % _n != 0) {
+                metrics::add(metric::logs_suppressed);
+                return false;
+            }
+            // Every message between two admitted ones was dropped, except the very first.
+            suppressed = i ? _n - 1 : 0;
+            return true;
+        }
+
+    private:
+        const uint64_t _n;
+        std::atomic<uint64_t> _seen{ 0 };
+    };
+
+} // namespace beauty
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifndef USING_METRICS
+#define USING_METRICS 1
+#endif
+
+namespace asio = boost::asio;
+
+namespace beauty {
+
+    // --------------------------------------------------------------------------
+    // Runtime metrics
+    // --------------------------------------------------------------------------
+
+    enum class metric : unsigned {
+        bytes_read,
+        bytes_written,
+        messages_read,
+        messages_written,
+        read_errors,
+        write_errors,
+        connects,
+        connect_errors,
+        reconnects,
+        accepts,
+        accept_errors,
+        active_sessions, ///< Gauge.
+        queued_write_bytes, ///< Gauge, bytes handed to an async write and not completed yet.
+        handler_invocations, ///< User callbacks invoked.
+        posted_tasks,
+        worker_exceptions,
+        logs_suppressed, ///< Log messages dropped by the rate limited or sampled macros.
+        timeouts, ///< Idle, read or write timeouts.
+        zerocopy_sends, ///< MSG_ZEROCOPY sends.
+        zerocopy_copied, ///< MSG_ZEROCOPY sends the kernel copied anyway, e.g. on loopback.
+        count_
+    };
+
+    /**
+     * @brief Aggregated values of all the metrics at one point in time.
+     */
+    struct metrics_snapshot {
+        static constexpr size_t size = static_cast<size_t>(metric::count_);
+
+        std::array<int64_t, size> values{};
+        std::chrono::steady_clock::time_point time;
+
+        int64_t operator[](metric m) const { return values[static_cast<size_t>(m)]; }
+
+        /**
+         * @brief Difference with an older snapshot, gauges are kept as is.
+         */
+        metrics_snapshot operator-(const metrics_snapshot &older) const
+        {
+            metrics_snapshot d = *this;
+            for (size_t i = 0; i < size; ++i) {
+                if (!is_gauge(static_cast<metric>(i))) {
+                    d.values[i] -= older.values[i];
+                }
+            }
+            return d;
+        }
+
+        static bool is_gauge(metric m)
+        {
+            return m == metric::active_sessions || m == metric::queued_write_bytes;
+        }
+
+        static const char *name(metric m)
+        {
+            static const char *names[size] = { "bytes_read", "bytes_written", "messages_read",
+                "messages_written", "read_errors", "write_errors", "connects", "connect_errors",
+                "reconnects", "accepts", "accept_errors", "active_sessions", "queued_write_bytes",
+                "handler_invocations", "posted_tasks", "worker_exceptions", "logs_suppressed",
+                "timeouts", "zerocopy_sends", "zerocopy_copied" };
+            return names[static_cast<size_t>(m)];
+        }
+    };
+
+    /**
+     * @brief Process wide registry of the library counters.
+     *      Every thread publishes into its own cache-line aligned slot with plain relaxed loads
+     *      and stores, so the hot path never touches a shared atomic. Slots are summed on demand
+     *      by @ref snapshot and outlive their thread, so totals never go backwards.
+     */
+    class metrics {
+        struct alignas(64) slot {
+            std::array<std::atomic<int64_t>, metrics_snapshot::size> values{};
+        };
+
+        struct registry {
+            std::mutex mutex;
+            std::vector<std::unique_ptr<slot>> slots;
+            std::vector<slot *> free;
+        };
+
+        // Gives the slot back to the registry when its thread exits.
+        struct handle {
+            slot *s;
+            handle()
+            {
+                auto &r = get_registry();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                if (!r.free.empty()) {
+                    s = r.free.back();
+                    r.free.pop_back();
+                } else {
+                    r.slots.emplace_back(new slot());
+                    s = r.slots.back().get();
+                }
+            }
+            ~handle()
+            {
+                auto &r = get_registry();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                r.free.push_back(s);
+            }
+        };
+
+    public:
+        /**
+         * @brief Add to a metric from the calling thread.
+         */
+        static void add(metric m, int64_t v = 1) noexcept
+        {
+#if USING_METRICS
+            auto &value = local().values[static_cast<size_t>(m)];
+            value.store(value.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+#else
+            (void)m;
+            (void)v;
+#endif
+        }
+
+        /**
+         * @brief Sum all the per-thread slots.
+         */
+        static metrics_snapshot snapshot()
+        {
+            metrics_snapshot snap;
+            snap.time = std::chrono::steady_clock::now();
+            auto &r = get_registry();
+            std::lock_guard<std::mutex> lock(r.mutex);
+            for (auto &s : r.slots) {
+                for (size_t i = 0; i < metrics_snapshot::size; ++i) {
+                    snap.values[i] += s->values[i].load(std::memory_order_relaxed);
+                }
+            }
+            return snap;
+        }
+
+    private:
+        static registry &get_registry()
+        {
+            // Never destroyed, thread_local handles may outlive static objects.
+            static registry *r = new registry();
+            return *r;
+        }
+
+        static slot &local()
+        {
+            thread_local handle h;
+            return *h.s;
+        }
+    };
+
+    // --------------------------------------------------------------------------
+    // Periodic snapshot
+    // --------------------------------------------------------------------------
+
+    /**
+     * @brief Take a @ref metrics snapshot periodically on an IO service.
+     */
+    class metrics_reporter : public std::enable_shared_from_this<metrics_reporter> {
+    public:
+        /**
+         * @param current Aggregated values.
+         * @param delta Difference with the previous report, see @ref metrics_snapshot::operator-.
+         * @param seconds Time elapsed since the previous report.
+         */
+        using report_t = std::function<void(
+            const metrics_snapshot &current, const metrics_snapshot &delta, double seconds)>;
+
+        metrics_reporter(asio::io_context &ioc, std::chrono::milliseconds interval, report_t report)
+            : _timer(ioc)
+            , _interval(interval)
+            , _report(std::move(report))
+            , _last(metrics::snapshot())
+        {
+        }
+
+        void start()
+        {
+            _timer.expires_after(_interval);
+            _timer.async_wait([me = shared_from_this()](const boost::system::error_code &ec) {
+                if (ec) {
+                    return;
+                }
+                auto now = metrics::snapshot();
+                double seconds = std::chrono::duration<double>(now.time - me->_last.time).count();
+                me->_report(now, now - me->_last, seconds);
+                me->_last = now;
+                me->start();
+            });
+        }
+
+        void stop() { _timer.cancel(); }
+
+    private:
+        asio::steady_timer _timer;
+        const std::chrono::milliseconds _interval;
+        report_t _report;
+        metrics_snapshot _last;
+    };
+
+} // namespace beauty
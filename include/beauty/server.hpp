@@ -4,53 +4,90 @@
 #include <beauty/application.hpp>
 #include <beauty/acceptor.hpp>
 
+#include <map>
 #include <string>
+#include <type_traits>
 
 namespace beauty {
 
     // --------------------------------------------------------------------------
-    class tcp_server {
+    // Server of a stream protocol, one acceptor per listened port, or socket path for the Unix
+    // domain sockets: `tcp_server` and `local_server`.
+    // --------------------------------------------------------------------------
+    template <typename _Protocol>
+    class basic_server {
 
-        using _Protocol = tcp;
         using cb_t = callback<_Protocol>;
         using edp_t = endpoint<_Protocol>;
         using sess_t = session<_Protocol>;
-        using accep_t = acceptor;
+        using accep_t = basic_acceptor<_Protocol>;
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+        static constexpr bool local = std::is_same<_Protocol, local_stream>::value;
+#else
+        static constexpr bool local = false;
+#endif
+        using key_t = std::conditional_t<local, std::string, int>;
 
     public:
-        tcp_server(std::string name = "tcp_server")
-            : _app(name)
+        basic_server(std::string name = local ? "local_server" : "tcp_server",
+            threading mode = threading::multi)
+            : _app(name, mode)
         {
         }
-        ~tcp_server() { stop(); }
+        ~basic_server() { stop(); }
 
-        tcp_server(const tcp_server &) = delete;
-        tcp_server &operator=(const tcp_server &) = delete;
+        basic_server(const basic_server &) = delete;
+        basic_server &operator=(const basic_server &) = delete;
 
-        tcp_server(tcp_server &&) = default;
-        tcp_server &operator=(tcp_server &&) = default;
+        basic_server(basic_server &&) = default;
+        basic_server &operator=(basic_server &&) = default;
 
-        tcp_server &concurrency(int concurrency)
+        basic_server &concurrency(int concurrency)
         {
             _concurrency = concurrency;
             return *this;
         }
 
+        /**
+         * @brief How the worker threads wait for events, see @ref application::polling.
+         */
+        basic_server &polling(
+            run_mode mode, std::chrono::microseconds spin = std::chrono::microseconds(100))
+        {
+            _app.polling(mode, spin);
+            return *this;
+        }
+
         /**
          * @brief Litsen on target local port.
          * @param port Local listening endpoint's port.
          * @param cb Callback on the connection.
          * @param verbose Verbose for the session of the connection.
+         * @param opt Options for the session of the connection.
          * @return client&
          */
-        const std::shared_ptr<accep_t> &listen(int port, const cb_t &cb, int verbose = 0)
+        const std::shared_ptr<accep_t> &listen(
+            int port, const cb_t &cb, int verbose = 0, const options &opt = {})
+        {
+            return listen(edp_t(address_v4(), port), cb, verbose, opt);
+        }
+
+        /**
+         * @brief Litsen on target local endpoint, e.g. a socket path for `local_server`.
+         * @param ep Local listening endpoint.
+         * @param cb Callback on the connection.
+         * @param verbose Verbose for the session of the connection.
+         * @param opt Options for the session of the connection.
+         */
+        const std::shared_ptr<accep_t> &listen(
+            const edp_t &ep, const cb_t &cb, int verbose = 0, const options &opt = {})
         {
             if (!_app.is_started()) {
                 _app.start(_concurrency);
             }
-            auto ep = edp_t(address_v4(), port);
-            _acceptors.emplace(port, std::make_shared<accep_t>(_app, ep, cb, verbose));
-            return _acceptors.at(port);
+            _acceptors.emplace(key(ep), std::make_shared<accep_t>(_app, ep, cb, verbose, opt));
+            return _acceptors.at(key(ep));
         }
 
         /**
@@ -86,15 +123,22 @@ namespace beauty {
 
         /**
          * @brief Access the acceptor on target port.
-         * @param port Local listening endpoint's port.
+         * @param port Local listening endpoint's port, or socket path.
          * @return const std::shared_ptr<acceptor>&
          */
-        const std::shared_ptr<accep_t> &get_acceptor(int port) const
+        const std::shared_ptr<accep_t> &get_acceptor(const key_t &port) const
         {
             assert(_acceptors.find(port) != _acceptors.end());
             return _acceptors.at(port);
         }
 
+        /**
+         * @brief Latency of the sessions served on target port, see @ref acceptor::latency.
+         * @param port Local listening endpoint's port, or socket path.
+         * @return latency_snapshot
+         */
+        latency_snapshot latency(const key_t &port) const { return get_acceptor(port)->latency(); }
+
         //std::vector<int> get_ports() const
         //{
         //    std::vector<int> keys;
@@ -104,10 +148,24 @@ namespace beauty {
         //}
 
     private:
+        static key_t key(const edp_t &ep)
+        {
+            if constexpr (local) {
+                return ep.path();
+            } else {
+                return ep.port();
+            }
+        }
+
         application _app;
         int _concurrency = 1;
         cb_t _callback;
-        std::map<int, std::shared_ptr<accep_t>> _acceptors;
+        std::map<key_t, std::shared_ptr<accep_t>> _acceptors;
     };
 
+    using tcp_server = basic_server<tcp>;
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    using local_server = basic_server<local_stream>;
+#endif
+
 } // namespace beauty
@@ -1,53 +1,87 @@
 #pragma once
 
 #include <beauty/header.hpp>
+#include <beauty/file.hpp>
+#include <beauty/histogram.hpp>
+#include <beauty/journal.hpp>
+#include <beauty/metrics.hpp>
+#include <beauty/throttle.hpp>
+#include <beauty/timer.hpp>
+#include <beauty/trace.hpp>
 
 #include <boost/asio.hpp>
 #include <boost/atomic.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <deque>
 #include <string>
 #include <memory>
+#include <random>
 #include <type_traits>
 
 namespace asio = boost::asio;
 
 namespace beauty {
 
+    inline uint64_t next_session_id()
+    {
+        static std::atomic<uint64_t> id{ 0 };
+        return id.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
     template <typename _Protocol>
     class session : public std::enable_shared_from_this<session<_Protocol>> {
 
         using cb_t = callback<_Protocol>;
         using edp_t = endpoint<_Protocol>;
         using socket_t = typename _Protocol::socket;
+        using clock_type = std::chrono::steady_clock;
+#if (BOOST_VERSION < 107400)
+        using executor_t = asio::executor;
+#else
+        using executor_t = asio::any_io_executor;
+#endif
+
+        // Keeps the `bool async` overloads of `write` for booleans and numbers.
+        template <typename T>
+        using if_token = std::enable_if_t<!std::is_arithmetic<std::decay_t<T>>::value>;
 
     public:
-        session(asio::io_context &ioc, const cb_t &cb, int verbose)
+        session(asio::io_context &ioc, const cb_t &cb, int verbose, const options &opt = {})
             : _callback(cb)
             , _verbose(verbose)
             , _socket(ioc)
-#if (BOOST_VERSION < 107000)
-            , _strand(_socket.get_executor())
-#else
-            , _strand(asio::make_strand(ioc))
-#endif
+            , _strand(make_executor(ioc))
+            , _single(single_threaded::of(ioc))
+            , _latency(opt.latency ? new latency_histograms() : nullptr)
+            , _options(opt)
+            , _timers(has_timeouts(opt) ? &timer::get(ioc) : nullptr)
+            , _ioc(ioc)
         {
+            limit_rate(opt.read_rate, opt.write_rate, opt.read_burst, opt.write_burst);
         }
 
-        session(asio::io_context &ioc, socket_t &&soc, const cb_t &cb, int verbose)
+        session(asio::io_context &ioc, socket_t &&soc, const cb_t &cb, int verbose,
+            const options &opt = {})
             : _callback(cb)
             , _verbose(verbose)
             , _socket(std::move(soc))
-#if (BOOST_VERSION < 107000)
-            , _strand(_socket.get_executor())
-#else
-            , _strand(asio::make_strand(ioc))
-#endif
+            , _strand(make_executor(ioc))
+            , _single(single_threaded::of(ioc))
+            , _latency(opt.latency ? new latency_histograms() : nullptr)
+            , _options(opt)
+            , _timers(has_timeouts(opt) ? &timer::get(ioc) : nullptr)
+            , _ioc(ioc)
         {
+            limit_rate(opt.read_rate, opt.write_rate, opt.read_burst, opt.write_burst);
+            set_socket_options();
         }
 
         ~session()
         {
             do_close();
+            metrics::add(metric::queued_write_bytes, -static_cast<int64_t>(_queued_bytes.load()));
             error_code ec;
             edp_t ep = _socket.local_endpoint(ec);
             BEAUTY_ERROR(_verbose > 0, "Session on " << ep << " destroyed.");
@@ -58,6 +92,49 @@ namespace beauty {
          */
         bool is_connnected() const { return _is_connnected; }
 
+        /**
+         * @brief Close the connection, `on_disconnected` is called. A pending reconnection is
+         *      cancelled.
+         */
+        void close()
+        {
+            _closed = true;
+            do_close();
+        }
+
+        /**
+         * @brief Access the latency histograms, safe to read from any thread.
+         * @return nullptr if @ref options::latency was not set.
+         */
+        const latency_histograms *latency() const { return _latency.get(); }
+
+        /**
+         * @brief Process wide unique id of the session, as recorded in the @ref journal.
+         */
+        uint64_t id() const { return _id; }
+
+        /**
+         * @brief Bytes in the async write queue, not written yet.
+         */
+        size_t queued_bytes() const { return _queued_bytes.load(std::memory_order_relaxed); }
+
+        /**
+         * @brief Change the bandwidth limits, see @ref options::read_rate.
+         * @param read_rate Bytes per second, 0 for unlimited.
+         * @param write_rate Bytes per second, 0 for unlimited.
+         * @param read_burst Bytes, one second of `read_rate` if 0.
+         * @param write_burst Bytes, one second of `write_rate` if 0.
+         */
+        void rate_limit(
+            double read_rate, double write_rate, double read_burst = 0, double write_burst = 0)
+        {
+            asio::dispatch(
+                _strand, [me = this->shared_from_this(), read_rate, write_rate, read_burst,
+                             write_burst]() {
+                    me->limit_rate(read_rate, write_rate, read_burst, write_burst);
+                });
+        }
+
         /**
          * @brief Make connection.
          * @param ep Target remote endpoint.
@@ -66,7 +143,17 @@ namespace beauty {
         {
             if (_is_connnected)
                 return;
+            if (!retry) {
+                _closed = false;
+                _connect_attempts = 0;
+            }
             BEAUTY_INFO(!retry, "Try connect to " << ep);
+            if (off_io_thread()) {
+                asio::post(_strand, [me = this->shared_from_this(), ep]() {
+                    me->connect(ep, true);
+                });
+                return;
+            }
             _socket.async_connect(ep, [me = this->shared_from_this(), ep](const error_code &ec) {
                 me->on_connect(ep, ec);
             });
@@ -78,7 +165,7 @@ namespace beauty {
          * @param async If using async reading mode.
          * @param buffer_size Size of the receiving buffer.
          */
-        void receive(endpoint<udp> ep, bool async,
+        void receive(edp_t ep, bool async,
             const size_t buffer_size = 32 * 1024 /* MTU max packet size */);
 
         /**
@@ -101,6 +188,21 @@ namespace beauty {
             do_write(boost::asio::buffer(pack.data(), pack.size()), async);
         }
 
+        /**
+         * @brief Write some data, the session takes the ownership of the buffer.
+         * @param pack The buffer in type of a packet of bytes.
+         * @param async If using async writing mode.
+         */
+        void write(std::vector<uint8_t> &&pack, bool async)
+        {
+            if (!async) {
+                do_write(boost::asio::buffer(pack.data(), pack.size()), false);
+                return;
+            }
+            auto owned = std::make_shared<std::vector<uint8_t>>(std::move(pack));
+            enqueue({ boost::asio::buffer(owned->data(), owned->size()), owned });
+        }
+
         /**
          * @brief Write some data.
          * @param pack The string type buffer.
@@ -111,6 +213,21 @@ namespace beauty {
             do_write(boost::asio::buffer(info.c_str(), info.size()), async);
         }
 
+        /**
+         * @brief Write some data, the session takes the ownership of the buffer.
+         * @param pack The string type buffer.
+         * @param async If using async writing mode.
+         */
+        void write(std::string &&info, bool async)
+        {
+            if (!async) {
+                do_write(boost::asio::buffer(info.c_str(), info.size()), false);
+                return;
+            }
+            auto owned = std::make_shared<std::string>(std::move(info));
+            enqueue({ boost::asio::buffer(owned->c_str(), owned->size()), owned });
+        }
+
         /**
          * @brief Write some data.
          * @param pack The stream type buffer.
@@ -121,27 +238,240 @@ namespace beauty {
             do_write(boost::asio::buffer(buf.data(), buf.size()), async);
         }
 
+        // --------------------------------------------------------------------------
+        // Per-write completion
+        // --------------------------------------------------------------------------
+
+        /**
+         * @brief Async write completing `token` with `(error_code, size_t bytes)` once this
+         *      message is fully written, or dropped with a failed session. The token may be a
+         *      callback `[](beauty::error_code, size_t) {}`, `asio::use_future` or, with C++20,
+         *      `asio::use_awaitable`; callbacks run on the session's io_context. `on_write`
+         *      is still called for every write.
+         * @param pack The buffer, must live until the completion.
+         * @param token Completion token, anything but a `bool`.
+         */
+        template <typename CompletionToken, typename = if_token<CompletionToken>>
+        auto write(const std::vector<uint8_t> &pack, CompletionToken &&token)
+        {
+            return enqueue({ boost::asio::buffer(pack.data(), pack.size()), nullptr },
+                std::forward<CompletionToken>(token));
+        }
+
+        /**
+         * @brief Async write with completion, the session takes the ownership of the buffer.
+         */
+        template <typename CompletionToken, typename = if_token<CompletionToken>>
+        auto write(std::vector<uint8_t> &&pack, CompletionToken &&token)
+        {
+            auto owned = std::make_shared<std::vector<uint8_t>>(std::move(pack));
+            return enqueue({ boost::asio::buffer(owned->data(), owned->size()), owned },
+                std::forward<CompletionToken>(token));
+        }
+
+        /**
+         * @brief Async write with completion, see above.
+         */
+        template <typename CompletionToken, typename = if_token<CompletionToken>>
+        auto write(const std::string &info, CompletionToken &&token)
+        {
+            return enqueue({ boost::asio::buffer(info.c_str(), info.size()), nullptr },
+                std::forward<CompletionToken>(token));
+        }
+
+        /**
+         * @brief Async write with completion, the session takes the ownership of the buffer.
+         */
+        template <typename CompletionToken, typename = if_token<CompletionToken>>
+        auto write(std::string &&info, CompletionToken &&token)
+        {
+            auto owned = std::make_shared<std::string>(std::move(info));
+            return enqueue({ boost::asio::buffer(owned->c_str(), owned->size()), owned },
+                std::forward<CompletionToken>(token));
+        }
+
+        /**
+         * @brief Async write with completion, see above.
+         */
+        template <typename CompletionToken, typename = if_token<CompletionToken>>
+        auto write(const boost::asio::streambuf &buf, CompletionToken &&token)
+        {
+            return enqueue({ boost::asio::buffer(buf.data(), buf.size()), nullptr },
+                std::forward<CompletionToken>(token));
+        }
+
+        /**
+         * @brief Async write with completion of bytes kept alive by `owner` until then, e.g. a
+         *      memory mapping, see @ref file_streamer.
+         */
+        template <typename CompletionToken>
+        auto write(boost::asio::const_buffer buffer, std::shared_ptr<const void> owner,
+            CompletionToken &&token)
+        {
+            return enqueue({ buffer, std::move(owner) }, std::forward<CompletionToken>(token));
+        }
+
+        // --------------------------------------------------------------------------
+        // File transmission
+        // --------------------------------------------------------------------------
+
+        /**
+         * @brief Send a file region to the peer with sendfile(2), stream sockets on Linux only.
+         *      It goes through the async write queue, in order with the other writes, and is never
+         *      read into memory: each time the socket is writable the kernel copies the next chunk
+         *      from the page cache to it, and `on_write` reports the chunk. A file that can not
+         *      be opened is only logged.
+         * @param path File to send.
+         * @param offset First byte to send.
+         * @param length Bytes to send, 0 for up to the end of the file.
+         * @note A queued file counts as one message, and no bytes, for the watermarks.
+         */
+        void send_file(const std::string &path, uint64_t offset = 0, uint64_t length = 0)
+        {
+            send_file(path, offset, length, [](error_code, size_t) {});
+        }
+
+        /**
+         * @brief Send a file region, completing `token` with `(error_code, size_t bytes)` once
+         *      it is sent, see above and @ref write.
+         */
+        template <typename CompletionToken>
+        auto send_file(
+            const std::string &path, uint64_t offset, uint64_t length, CompletionToken &&token)
+        {
+            auto file = std::make_shared<file_region>();
+            error_code ec = file->open(path, offset, length);
+            return send_region(std::move(file), ec, std::forward<CompletionToken>(token));
+        }
+
+        /**
+         * @brief Send a region of an open file, see above.
+         * @param fd Left open, must stay so until the completion.
+         */
+        template <typename CompletionToken>
+        auto send_file(int fd, uint64_t offset, uint64_t length, CompletionToken &&token)
+        {
+            auto file = std::make_shared<file_region>();
+            error_code ec = file->assign(fd, offset, length, false);
+            return send_region(std::move(file), ec, std::forward<CompletionToken>(token));
+        }
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+        // --------------------------------------------------------------------------
+        // Coroutines
+        // --------------------------------------------------------------------------
+
+        /**
+         * @brief Make connection in a coroutine: `co_await sess->async_connect(ep);`
+         *      Unlike @ref connect, `on_connected` and `on_connect_failed` are not called and
+         *      nothing is retried, a failure is thrown as `boost::system::system_error`.
+         * @note The coroutine frames come from asio's per-thread recycling allocator, a loop
+         *      of awaited operations does not allocate them once warm.
+         */
+        asio::awaitable<void> async_connect(edp_t ep)
+        {
+            auto me = this->shared_from_this();
+            _closed = false;
+            error_code ec;
+            co_await _socket.async_connect(ep, asio::redirect_error(asio::use_awaitable, ec));
+            connected(ep, ec);
+            if (ec) {
+                throw boost::system::system_error(ec);
+            }
+        }
+
+        /**
+         * @brief Read some data into `buffer` in a coroutine:
+         *      `size_t n = co_await sess->async_read(asio::buffer(data));`
+         *      `on_read` is not called. A failure closes the session, as the default
+         *      `on_read_failed` does, and is thrown as `boost::system::system_error`.
+         * @param buffer Filled with the bytes read, must live until the read completes.
+         * @return Bytes read.
+         */
+        asio::awaitable<size_t> async_read(asio::mutable_buffer buffer)
+        {
+            auto me = this->shared_from_this();
+            reading();
+            auto t0 = stamp();
+            error_code ec;
+            size_t tbytes = co_await _socket.async_receive(
+                buffer, asio::redirect_error(asio::use_awaitable, ec));
+            record(&latency_histograms::read, t0);
+            read_done();
+            BEAUTY_PROBE3(read_complete, this, tbytes, ec.value());
+            journal::record(journal_event::read, _id, tbytes, ec.value());
+            if (ec) {
+                BEAUTY_ERROR_RL(_verbose > 0, BEAUTY_ERROR_RATE, BEAUTY_ERROR_BURST,
+                    "Read faild with error (" << ec.value() << "): " << ec.message());
+                metrics::add(metric::read_errors);
+                do_close();
+                throw boost::system::system_error(ec);
+            }
+            BEAUTY_VINFO(2, _verbose,
+                BEAUTY_LITERAL("Successfully read ") << tbytes << BEAUTY_LITERAL(" bytes."));
+            metrics::add(metric::bytes_read, static_cast<int64_t>(tbytes));
+            metrics::add(metric::messages_read);
+            co_return tbytes;
+        }
+
+        /**
+         * @brief Write `buffer` in a coroutine: `co_await sess->async_write(asio::buffer(data));`
+         *      The message goes through the async write queue, in order with the other writes,
+         *      and the coroutine resumes once all of its bytes are written. A failure, or the
+         *      message dropped with a closed session, is thrown as `boost::system::system_error`.
+         * @param buffer Must live until the write completes.
+         * @return Bytes written.
+         */
+        asio::awaitable<size_t> async_write(asio::const_buffer buffer)
+        {
+            return enqueue({ buffer, nullptr }, asio::use_awaitable);
+        }
+#endif
+
     protected:
         void on_connect(const edp_t &ep, const error_code &ec)
         {
+            connected(ep, ec);
             if (ec) {
-                BEAUTY_ERROR(_verbose > 0,
-                    "Connect to " << ep << " faild with error (" << ec.value()
-                                  << "): " << ec.message());
-                // Only refused connection could be reconnect.
-                if (_callback.on_connect_failed(*this, ep, ec) && !_is_connnected
-                    && ec == boost::system::errc::connection_refused) {
-                    connect(ep, true);
+                if (invoke(probe_on_connect_failed, _callback.on_connect_failed, *this, ep, ec)
+                    && !_is_connnected && ec != asio::error::operation_aborted) {
+                    reconnect(ep);
                 }
-                return;
             } else {
-                BEAUTY_INFO(true, "Succeed connecting to " << ep);
                 error_code ecx;
                 auto ep = _socket.local_endpoint(ecx);
                 auto epr = _socket.remote_endpoint(ecx);
-                _is_connnected = true;
+                invoke(probe_on_connected, _callback.on_connected, *this, ep, epr);
+            }
+        }
 
-                _callback.on_connected(*this, ep, epr);
+        // Account for a connection attempt.
+        void connected(const edp_t &ep, const error_code &ec)
+        {
+            BEAUTY_PROBE2(connect, this, ec.value());
+            journal::record(journal_event::connect, _id, 0, ec.value());
+            if (ec) {
+                BEAUTY_ERROR_RL(_verbose > 0, BEAUTY_ERROR_RATE, BEAUTY_ERROR_BURST,
+                    "Connect to " << ep << " faild with error (" << ec.value()
+                                  << "): " << ec.message());
+                metrics::add(metric::connect_errors);
+            } else {
+                BEAUTY_INFO(true, "Succeed connecting to " << ep);
+                if (_options.zerocopy_threshold > 0) {
+                    asio::dispatch(_strand, [me = this->shared_from_this()]() {
+                        me->reset_zerocopy(asio::error::connection_aborted);
+                    });
+                }
+                set_socket_options();
+                _is_connnected = true;
+                _connect_attempts = 0;
+                // The deadlines run from the new connection.
+                touch(_last_read);
+                touch(_last_write);
+                _pings.store(0, std::memory_order_relaxed);
+                watch_timeouts();
+                metrics::add(metric::connects);
+                metrics::add(metric::active_sessions);
             }
         }
 
@@ -152,20 +482,677 @@ namespace beauty {
 
         void do_write(const boost::asio::const_buffer &&buffer, bool async);
 
-        void on_write(const boost::asio::const_buffer &buffer, error_code ec, std::size_t tbytes)
+        /**
+         * @brief Report a write.
+         * @return On failure, whether the write should be tried again. Otherwise the session is
+         *      closed.
+         */
+        bool on_write(error_code ec, std::size_t tbytes)
         {
             if (ec) {
-                BEAUTY_ERROR(_verbose > 0,
+                BEAUTY_ERROR_RL(_verbose > 0, BEAUTY_ERROR_RATE, BEAUTY_ERROR_BURST,
                     "Write faild with error (" << ec.value() << "): " << ec.message());
+                BEAUTY_PROBE3(write_complete, this, tbytes, ec.value());
+                journal::record(journal_event::write, _id, tbytes, ec.value());
+                metrics::add(metric::write_errors);
                 // Will re-write only when connected.
-                if (_callback.on_write_failed(*this, ec) && _is_connnected) {
-                    do_write(std::move(buffer), true);
+                if (invoke(probe_on_write_failed, _callback.on_write_failed, *this, ec)
+                    && _is_connnected) {
+                    return true;
+                }
+                do_close();
+                return false;
+            } else {
+                BEAUTY_VINFO(2, _verbose,
+                    BEAUTY_LITERAL("Successfully write ") << tbytes << BEAUTY_LITERAL(" bytes."));
+                BEAUTY_PROBE3(write_complete, this, tbytes, 0);
+                journal::record(journal_event::write, _id, tbytes, 0);
+                metrics::add(metric::bytes_written, static_cast<int64_t>(tbytes));
+                metrics::add(metric::messages_written);
+                auto t0 = stamp();
+                invoke(probe_on_write, _callback.on_write, *this, tbytes);
+                record(&latency_histograms::callback, t0);
+                return true;
+            }
+        }
+
+        // --------------------------------------------------------------------------
+        // Async write queue
+        // --------------------------------------------------------------------------
+
+        /**
+         * @brief One queued message. The bytes are borrowed from the caller, as with the
+         *      `const &` writes, or kept alive by `owner`.
+         */
+        struct write_entry {
+            write_entry() = default;
+            write_entry(boost::asio::const_buffer b, std::shared_ptr<const void> o)
+                : buffer(b)
+                , owner(std::move(o))
+            {
+            }
+
+            boost::asio::const_buffer buffer;
+            std::shared_ptr<const void> owner;
+            /// Called on the strand once the message is written, or dropped, if set.
+            std::function<void(error_code, size_t)> done;
+            size_t written = 0;
+            /// Sent with sendfile(2) instead of `buffer`, see @ref send_file.
+            std::shared_ptr<file_region> file;
+            /// MSG_ZEROCOPY sends of the message, numbered from `zerocopy_first` by the kernel.
+            uint32_t zerocopy_first = 0;
+            uint32_t zerocopy_sends = 0;
+            uint32_t zerocopy_acked = 0;
+        };
+
+        /**
+         * @brief Queue an async write, completing `token` with `(error_code, size_t)` once the
+         *      message is fully written, or dropped. Handlers run on their associated executor,
+         *      by default the session's io_context, never inline on the strand.
+         */
+        template <typename CompletionToken>
+        auto enqueue(write_entry &&entry, CompletionToken &&token)
+        {
+            return asio::async_initiate<CompletionToken, void(error_code, size_t)>(
+                [me = this->shared_from_this()](auto handler, write_entry entry) {
+                    auto ex = asio::get_associated_executor(handler, me->_ioc.get_executor());
+                    // Handlers may be move-only, a std::function needs a copyable one.
+                    auto h = std::make_shared<decltype(handler)>(std::move(handler));
+                    entry.done = [h, ex](error_code ec, size_t tbytes) {
+                        asio::post(ex, [h, ec, tbytes]() { std::move(*h)(ec, tbytes); });
+                    };
+                    me->enqueue(std::move(entry));
+                },
+                token, std::move(entry));
+        }
+
+        /**
+         * @brief Queue an async write. Messages are written in order, one at a time, on the
+         *      strand.
+         */
+        void enqueue(write_entry &&entry)
+        {
+            // Counted at once for the producers, but by the IO thread when single threaded.
+            if (!_single) {
+                queued(entry.buffer.size());
+            }
+            asio::dispatch(_strand,
+                [me = this->shared_from_this(), entry = std::move(entry)]() mutable {
+                    if (me->_single) {
+                        me->queued(entry.buffer.size());
+                    }
+                    me->_write_queue.push_back(std::move(entry));
+                    me->check_backpressure();
+                    if (!me->_writing) {
+                        me->touch(me->_last_write);
+                        me->watch_timeouts();
+                        me->_writing = true;
+                        me->start_write();
+                    }
+                });
+        }
+
+        // Start the async write of the head of the queue, on the strand.
+        void write_head();
+
+        template <typename CompletionToken>
+        auto send_region(std::shared_ptr<file_region> file, error_code ec, CompletionToken &&token)
+        {
+            static_assert(is_stream<_Protocol>::value, "send_file is for stream sockets only");
+            BEAUTY_ERROR(ec && _verbose > 0,
+                "Send file faild with error (" << ec.value() << "): " << ec.message());
+            if (ec || file->left == 0) {
+                // Nothing to queue, complete at once.
+                return asio::async_initiate<CompletionToken, void(error_code, size_t)>(
+                    [ex = _ioc.get_executor()](auto handler, error_code ec) {
+                        auto hex = asio::get_associated_executor(handler, ex);
+                        asio::post(hex, [h = std::move(handler), ec]() mutable {
+                            std::move(h)(ec, 0);
+                        });
+                    },
+                    token, ec);
+            }
+            write_entry entry;
+            entry.file = std::move(file);
+            return enqueue(std::move(entry), std::forward<CompletionToken>(token));
+        }
+
+        // Send the next chunk of the head file once the socket is writable, on the strand.
+        void send_file_chunk(error_code ec, clock_type::time_point t0);
+
+        // --------------------------------------------------------------------------
+        // Zero-copy sends
+        // --------------------------------------------------------------------------
+
+        bool zerocopy(const write_entry &entry) const
+        {
+            return _zerocopy && (entry.owner || entry.done)
+                && entry.written + entry.buffer.size() >= _options.zerocopy_threshold;
+        }
+
+        // Send the next chunk of the head message with MSG_ZEROCOPY, on the strand.
+        void send_zerocopy_chunk(error_code ec, clock_type::time_point t0);
+
+        // Wait for the kernel notifications while sent messages are pending, on the strand.
+        void watch_zerocopy();
+
+        // Completion of the error queue wait, on the strand.
+        void reap_zerocopy(error_code ec);
+
+        // Read the notifications of the socket error queue without blocking, on the strand.
+        error_code drain_zerocopy();
+
+        /**
+         * @brief Start over with a new socket, on the strand: the kernel numbers its sends from 0
+         *      again. The messages still pending complete with `ec`, their data was purged with
+         *      the previous connection, see @ref do_close.
+         */
+        void reset_zerocopy(error_code ec)
+        {
+            auto pending = std::move(_zerocopy_pending);
+            _zerocopy_pending.clear();
+            _zerocopy_seq = 0;
+            _zerocopy_unacked.store(0, std::memory_order_relaxed);
+            _zerocopy_watching = false;
+            ++_zerocopy_epoch; // A wait on the previous socket completes as stale.
+            for (auto &entry : pending) {
+                if (entry.done) {
+                    entry.done(ec, entry.written);
+                }
+            }
+        }
+
+        // Account for the kernel releasing the sends numbered `first` to `last`.
+        void zerocopy_acked(uint32_t first, uint32_t last)
+        {
+            // Modulo 2^32, the numbers wrap.
+            const uint32_t span = last - first + 1;
+            const uint32_t unacked = _zerocopy_unacked.load(std::memory_order_relaxed);
+            _zerocopy_unacked.store(unacked - std::min(unacked, span), std::memory_order_relaxed);
+            for (auto it = _zerocopy_pending.begin(); it != _zerocopy_pending.end();) {
+                const uint32_t n = it->zerocopy_sends;
+                if (uint32_t into = first - it->zerocopy_first; into < n) {
+                    it->zerocopy_acked += std::min(n - into, span);
+                } else if (uint32_t before = it->zerocopy_first - first; before < span) {
+                    it->zerocopy_acked += std::min(n, span - before);
+                }
+                if (it->zerocopy_acked >= it->zerocopy_sends) {
+                    if (it->done) {
+                        it->done({}, it->written);
+                    }
+                    it = _zerocopy_pending.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        // Write the head of the queue once the write rate allows it.
+        void start_write()
+        {
+            if (_write_limit) {
+                auto delay = _write_limit->delay();
+                if (delay > clock_type::duration::zero()) {
+                    // Not stalled, the write deadline runs from the actual write, as for reads.
+                    _pacing = true;
+                    _write_timer->expires_after(delay);
+                    _write_timer->async_wait(asio::bind_executor(_strand,
+                        [me = this->shared_from_this()](const error_code &ec) {
+                            me->_pacing = false;
+                            me->touch(me->_last_write);
+                            if (!ec) {
+                                me->start_write();
+                            } else {
+                                me->_writing = false;
+                            }
+                        }));
+                    return;
+                }
+            }
+            write_head();
+        }
+
+        // Completion of @ref write_head, on the strand.
+        void on_queued_write(error_code ec, std::size_t tbytes)
+        {
+            touch(_last_write);
+            if (!ec) {
+                if (_write_limit) {
+                    _write_limit->consume(tbytes);
+                }
+                write_entry &head = _write_queue.front();
+                head.written += tbytes;
+                size_t left = 0;
+                if (head.file) {
+                    // Files are not in memory, they only count as a message.
+                    head.file->offset += tbytes;
+                    head.file->left -= tbytes;
+                    left = static_cast<size_t>(head.file->left);
+                    dequeued(0, left == 0 ? 1 : 0);
                 } else {
+                    head.buffer += tbytes;
+                    left = head.buffer.size();
+                    dequeued(tbytes, left == 0 ? 1 : 0);
+                }
+                if (left == 0) {
+                    if (head.zerocopy_sends) {
+                        // Still referenced by the kernel, kept until it says otherwise.
+                        _zerocopy_pending.push_back(std::move(head));
+                        watch_zerocopy();
+                    } else if (head.done) {
+                        head.done(ec, head.written);
+                    }
+                    _write_queue.pop_front();
+                }
+            }
+
+            if (on_write(ec, tbytes) && !_write_queue.empty()) {
+                start_write();
+                return;
+            }
+            if (ec) {
+                // Not retried, the session is closed: drop what is left.
+                size_t bytes = 0;
+                for (auto &entry : _write_queue) {
+                    bytes += entry.buffer.size();
+                    if (entry.zerocopy_sends) {
+                        // Partly sent from the buffer, released along with the notifications.
+                        _zerocopy_pending.push_back(std::move(entry));
+                    } else if (entry.done) {
+                        entry.done(ec, entry.written);
+                    }
+                }
+                dequeued(bytes, _write_queue.size());
+                _write_queue.clear();
+                watch_zerocopy();
+            }
+            _writing = false;
+        }
+
+        void queued(size_t bytes)
+        {
+            count(_queued_bytes, bytes);
+            count(_queued_messages, 1);
+            metrics::add(metric::queued_write_bytes, static_cast<int64_t>(bytes));
+        }
+
+        void dequeued(size_t bytes, size_t messages)
+        {
+            count(_queued_bytes, 0 - bytes);
+            count(_queued_messages, 0 - messages);
+            metrics::add(metric::queued_write_bytes, -static_cast<int64_t>(bytes));
+            check_backpressure();
+        }
+
+        // Fire `on_write_backpressure` and pause or resume reading on watermark crossings.
+        void check_backpressure()
+        {
+            const size_t bytes = _queued_bytes.load(std::memory_order_relaxed);
+            const size_t messages = _queued_messages.load(std::memory_order_relaxed);
+            if (!_congested) {
+                if ((_options.write_high_watermark && bytes >= _options.write_high_watermark)
+                    || (_options.write_high_messages
+                        && messages >= _options.write_high_messages)) {
+                    _congested = true;
+                    _read_paused = _options.pause_read_on_backpressure;
+                    invoke(probe_on_write_backpressure, _callback.on_write_backpressure, *this,
+                        true, bytes);
+                }
+            } else if ((!_options.write_high_watermark || bytes <= _options.write_low_watermark)
+                && (!_options.write_high_messages || messages <= _options.write_low_messages)) {
+                _congested = false;
+                invoke(probe_on_write_backpressure, _callback.on_write_backpressure, *this, false,
+                    bytes);
+                _read_paused = false;
+                if (_read_deferred) {
+                    _read_deferred = false;
+                    rearm_read(_deferred_ep);
+                }
+            }
+        }
+
+        /**
+         * @brief Called instead of re-arming a read.
+         * @return `true` if the read is deferred until the write queue drains.
+         */
+        bool defer_read(const edp_t &ep)
+        {
+            if (!_read_paused) {
+                return false;
+            }
+            _read_deferred = true;
+            _deferred_ep = ep;
+            return true;
+        }
+
+        // Re-arm a read deferred by @ref defer_read.
+        void resume_read(const edp_t &ep);
+
+        /**
+         * @brief Re-arm an async read after `tbytes` were read, unless paused by backpressure,
+         *      and later if over the read rate.
+         */
+        void rearm_read(const edp_t &ep, size_t tbytes = 0)
+        {
+            if (_read_limit) {
+                _read_limit->consume(tbytes);
+            }
+            if (defer_read(ep)) {
+                return;
+            }
+            if (_read_limit) {
+                auto delay = _read_limit->delay();
+                if (delay > clock_type::duration::zero()) {
+                    _read_timer->expires_after(delay);
+                    _read_timer->async_wait(asio::bind_executor(_strand,
+                        [me = this->shared_from_this(), ep](const error_code &ec) {
+                            if (!ec && me->_is_connnected) {
+                                me->rearm_read(ep);
+                            }
+                        }));
+                    return;
+                }
+            }
+            resume_read(ep);
+        }
+
+        /**
+         * @brief Retry a failed connection after the @ref options::reconnect delay. The wait is
+         *      a timer wheel entry, so no IO thread ever sleeps or spins on a down peer.
+         */
+        void reconnect(const edp_t &ep)
+        {
+            const auto &policy = _options.reconnect;
+            unsigned attempt = ++_connect_attempts;
+            if (policy.max_attempts && attempt > policy.max_attempts) {
+                BEAUTY_ERROR(_verbose > 0,
+                    "Give up connecting to " << ep << " after " << policy.max_attempts
+                                             << " retries");
+                return;
+            }
+
+            double delay = static_cast<double>(policy.min_delay.count());
+            for (unsigned i = 1; i < attempt && delay < policy.max_delay.count(); ++i) {
+                delay *= policy.multiplier;
+            }
+            delay = std::min(delay, static_cast<double>(policy.max_delay.count()));
+            if (policy.jitter > 0) {
+                thread_local std::minstd_rand rng{ std::random_device{}() };
+                std::uniform_real_distribution<double> spread(0, std::min(policy.jitter, 1.0));
+                delay -= delay * spread(rng);
+            }
+
+            // A failed socket can not connect again.
+            error_code ec;
+            _socket.close(ec);
+            metrics::add(metric::reconnects);
+            BEAUTY_INFO(_verbose > 0,
+                "Reconnect to " << ep << " in " << static_cast<int64_t>(delay) << " ms");
+            timer::get(_ioc).schedule(
+                std::chrono::duration_cast<timer::clock_type::duration>(
+                    std::chrono::duration<double, std::milli>(delay)),
+                [w = this->weak_from_this(), ep]() {
+                    auto me = w.lock();
+                    if (me && !me->_closed) {
+                        me->connect(ep, true);
+                    }
+                });
+        }
+
+        // --------------------------------------------------------------------------
+        // Timeouts
+        // --------------------------------------------------------------------------
+
+        static bool has_timeouts(const options &opt)
+        {
+            return opt.idle_timeout.count() > 0 || opt.read_timeout.count() > 0
+                || opt.write_timeout.count() > 0 || opt.heartbeat.interval.count() > 0;
+        }
+
+        // Activity timestamps are coarse and relaxed: a timeout is only checked every so often.
+        void touch(std::atomic<int64_t> &last)
+        {
+            if (_timers) {
+                last.store(timer::coarse_now().time_since_epoch().count(),
+                    std::memory_order_relaxed);
+            }
+        }
+
+        // An async read is armed.
+        void reading()
+        {
+            if (_timers) {
+                touch(_last_read);
+                _reading.store(true, std::memory_order_relaxed);
+                watch_timeouts();
+            }
+        }
+
+        // An async read completed.
+        void read_done()
+        {
+            if (_timers) {
+                _reading.store(false, std::memory_order_relaxed);
+                _pings.store(0, std::memory_order_relaxed);
+                touch(_last_read);
+            }
+        }
+
+        // Start checking the deadlines, once, on the first async operation.
+        void watch_timeouts()
+        {
+            if (_timers && !_watching.exchange(true)) {
+                schedule_timeouts(std::min({ enabled(_options.idle_timeout),
+                    enabled(_options.read_timeout), enabled(_options.write_timeout),
+                    enabled(_options.heartbeat.interval) }));
+            }
+        }
+
+        // The checks stop with the connection, connecting again starts them again.
+        void unwatch_timeouts()
+        {
+            _watching = false;
+            if (_is_connnected) {
+                watch_timeouts(); // Reconnected meanwhile, before the flag was cleared.
+            }
+        }
+
+        static timer::clock_type::duration enabled(std::chrono::milliseconds t)
+        {
+            return t.count() > 0 ? timer::clock_type::duration(t)
+                                 : timer::clock_type::duration::max();
+        }
+
+        void schedule_timeouts(timer::clock_type::duration delay)
+        {
+            // Never keeps the session alive, the next check is just dropped once it is gone.
+            _timers->schedule(delay, [w = this->weak_from_this()]() {
+                if (auto me = w.lock()) {
+                    asio::post(me->_strand, [me]() { me->check_timeouts(); });
+                }
+            });
+        }
+
+        // Fire the expired deadlines and schedule the next check, on the strand.
+        void check_timeouts()
+        {
+            if (!_socket.is_open()) {
+                unwatch_timeouts();
+                return;
+            }
+            const auto now = timer::coarse_now().time_since_epoch();
+            auto next = timer::clock_type::duration::max();
+            auto expired = [&](std::chrono::milliseconds limit, std::atomic<int64_t> &last,
+                               bool armed) {
+                if (limit.count() <= 0 || !armed) {
+                    if (limit.count() > 0) {
+                        next = std::min(next, timer::clock_type::duration(limit));
+                    }
+                    return false;
+                }
+                auto left = timer::clock_type::duration(limit)
+                    - (now - timer::clock_type::duration(last.load(std::memory_order_relaxed)));
+                if (left > timer::clock_type::duration::zero()) {
+                    next = std::min(next, left);
+                    return false;
+                }
+                next = std::min(next, timer::clock_type::duration(limit));
+                return true;
+            };
+
+            const std::pair<timeout_kind, bool> checks[] = {
+                { timeout_kind::read,
+                    expired(_options.read_timeout, _last_read, _reading.load()) },
+                { timeout_kind::write,
+                    expired(_options.write_timeout, _last_write, _writing && !_pacing) },
+                { timeout_kind::idle,
+                    expired(_options.idle_timeout,
+                        _last_read.load() > _last_write.load() ? _last_read : _last_write,
+                        true) },
+            };
+            // Returns `false` once the session is closed.
+            auto fire = [&](timeout_kind kind) {
+                BEAUTY_INFO(_verbose > 0, "Session timeout (" << static_cast<int>(kind) << ")");
+                metrics::add(metric::timeouts);
+                if (!invoke(probe_on_timeout, _callback.on_timeout, *this, kind)) {
                     do_close();
+                    unwatch_timeouts();
+                    return false;
+                }
+                return true;
+            };
+            for (auto &check : checks) {
+                if (!check.second) {
+                    continue;
+                }
+                if (!fire(check.first)) {
+                    return;
                 }
+                // Kept: wait a full timeout again.
+                touch(check.first == timeout_kind::write ? _last_write : _last_read);
+                if (check.first == timeout_kind::idle) {
+                    touch(_last_write);
+                }
+            }
+
+            const auto &heartbeat = _options.heartbeat;
+            if (heartbeat.interval.count() > 0) {
+                auto interval = timer::clock_type::duration(heartbeat.interval);
+                auto last = timer::clock_type::duration(_last_write.load(std::memory_order_relaxed));
+                auto left = interval - (now - last);
+                if (left <= timer::clock_type::duration::zero()) {
+                    if (_pings.load(std::memory_order_relaxed) >= heartbeat.missed) {
+                        if (!fire(timeout_kind::heartbeat)) {
+                            return;
+                        }
+                        _pings.store(0, std::memory_order_relaxed);
+                    }
+                    // The payload lives in the session options, no copy.
+                    _pings.fetch_add(1, std::memory_order_relaxed);
+                    enqueue({ asio::buffer(heartbeat.payload), nullptr });
+                    left = interval;
+                }
+                next = std::min(next, left);
+            }
+            schedule_timeouts(next);
+        }
+
+        static executor_t make_executor(asio::io_context &ioc)
+        {
+#if (BOOST_VERSION < 107000)
+            return ioc.get_executor();
+#else
+            if (single_threaded::of(ioc)) {
+                return ioc.get_executor();
+            }
+            return asio::make_strand(ioc);
+#endif
+        }
+
+        /**
+         * @brief Single threaded, the reactor has no per-socket lock: async operations must be
+         *      started by the IO thread, and are posted there when called from another one.
+         */
+        bool off_io_thread() const
+        {
+            return _single && !_ioc.get_executor().running_in_this_thread();
+        }
+
+        /**
+         * @brief Add `n` to a queue counter, wrapping around to subtract. Single threaded, the
+         *      counter is only written by the IO thread: a plain load and store, no locked
+         *      instruction.
+         */
+        void count(std::atomic<size_t> &counter, size_t n)
+        {
+            if (_single) {
+                counter.store(counter.load(std::memory_order_relaxed) + n,
+                    std::memory_order_relaxed);
             } else {
-                BEAUTY_INFO(_verbose > 1, "Successfully write " << tbytes << " bytes.");
-                _callback.on_write(*this, tbytes);
+                counter.fetch_add(n, std::memory_order_relaxed);
+            }
+        }
+
+        // Apply the socket level options to the open socket.
+        void set_socket_options()
+        {
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+            if constexpr (std::is_same<_Protocol, tcp>::value) {
+                if (_options.zerocopy_threshold > 0 && _socket.is_open()) {
+                    error_code ec;
+                    _socket.set_option(
+                        asio::detail::socket_option::boolean<SOL_SOCKET, SO_ZEROCOPY>(true), ec);
+                    _zerocopy = !ec;
+                    BEAUTY_ERROR_RL(ec && _verbose > 0, BEAUTY_ERROR_RATE, BEAUTY_ERROR_BURST,
+                        "Set SO_ZEROCOPY faild with error (" << ec.value()
+                                                             << "): " << ec.message());
+                }
+            }
+#endif
+#ifdef SO_BUSY_POLL
+            if (_options.busy_poll.count() > 0 && _socket.is_open()) {
+                error_code ec;
+                _socket.set_option(
+                    asio::detail::socket_option::integer<SOL_SOCKET, SO_BUSY_POLL>(
+                        static_cast<int>(_options.busy_poll.count())),
+                    ec);
+                BEAUTY_ERROR_RL(ec && _verbose > 0, BEAUTY_ERROR_RATE, BEAUTY_ERROR_BURST,
+                    "Set SO_BUSY_POLL faild with error (" << ec.value() << "): " << ec.message());
+            }
+#endif
+        }
+
+        // Only called on the strand, or from the constructor.
+        void limit_rate(double read_rate, double write_rate, double read_burst, double write_burst)
+        {
+            _read_limit.reset(read_rate > 0 ? new token_bucket(read_rate, read_burst) : nullptr);
+            _write_limit.reset(
+                write_rate > 0 ? new token_bucket(write_rate, write_burst) : nullptr);
+            if (_read_limit && !_read_timer) {
+                _read_timer.reset(new asio::steady_timer(_strand));
+            }
+            if (_write_limit && !_write_timer) {
+                _write_timer.reset(new asio::steady_timer(_strand));
+            }
+        }
+
+        /**
+         * @brief Time point for a latency measure, only taken when recording.
+         */
+        clock_type::time_point stamp() const
+        {
+            return _latency ? clock_type::now() : clock_type::time_point();
+        }
+
+        /**
+         * @brief Record the time elapsed since `t0` into one of the latency histograms.
+         */
+        void record(histogram latency_histograms::*which, clock_type::time_point t0)
+        {
+            if (_latency) {
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    clock_type::now() - t0);
+                (_latency.get()->*which).record(static_cast<uint64_t>(ns.count()));
             }
         }
 
@@ -177,23 +1164,124 @@ namespace beauty {
             error_code ec;
             edp_t epx = _socket.remote_endpoint(ec);
             BEAUTY_ERROR(true, "Close connection on " << epx);
-            // Send a TCP shutdown
-            _socket.shutdown(socket_t::shutdown_send, ec);
+            if (_zerocopy_unacked.load(std::memory_order_relaxed)) {
+                // The kernel still sends from buffers that the session is about to release: reset
+                // the connection, which purges its send queue, instead of a graceful shutdown.
+                _socket.set_option(asio::socket_base::linger(true, 0), ec);
+            } else {
+                // Send a TCP shutdown
+                _socket.shutdown(socket_t::shutdown_send, ec);
+            }
             _socket.close();
             _is_connnected = false;
-            _callback.on_disconnected(*this, epx);
+            BEAUTY_PROBE1(close, this);
+            journal::record(journal_event::close, _id, 0, 0);
+            metrics::add(metric::active_sessions, -1);
+            invoke(probe_on_disconnected, _callback.on_disconnected, *this, epx);
+        }
+
+        /**
+         * @brief Invoke a user callback, counted and wrapped by the callback_entry/callback_exit
+         * probes.
+         */
+        template <typename F, typename... Args>
+        auto invoke(probe_cb kind, const F &f, Args &&... args)
+            -> decltype(f(std::forward<Args>(args)...))
+        {
+            struct exit_probe {
+                const session *sess;
+                int kind;
+                ~exit_probe() { BEAUTY_PROBE2(callback_exit, sess, kind); }
+            } guard{ this, kind };
+            (void)guard;
+
+            metrics::add(metric::handler_invocations);
+            BEAUTY_PROBE2(callback_entry, this, static_cast<int>(kind));
+            return f(std::forward<Args>(args)...);
         }
 
     protected:
-        friend class acceptor;
+        template <typename> friend class basic_acceptor;
         boost::atomic<bool> _is_connnected = false;
 
     private:
         socket_t _socket;
-        asio::strand<asio::io_context::executor_type> _strand;
+        /// A strand, or the io_context executor itself when @ref single_threaded.
+        const executor_t _strand;
+        const bool _single;
         boost::asio::streambuf _buffer;
         const cb_t &_callback;
         const int _verbose;
+        const std::unique_ptr<latency_histograms> _latency;
+        const uint64_t _id = next_session_id();
+        const options _options;
+
+        // Async write queue, only touched on the strand but the counters.
+        std::deque<write_entry> _write_queue;
+        std::atomic<size_t> _queued_bytes{ 0 };
+        std::atomic<size_t> _queued_messages{ 0 };
+        bool _writing = false;
+        bool _pacing = false; ///< Waiting on the write rate limit.
+        bool _congested = false;
+        bool _read_paused = false;
+        bool _read_deferred = false;
+        edp_t _deferred_ep;
+
+        // Bandwidth limits, only touched on the strand.
+        std::unique_ptr<token_bucket> _read_limit;
+        std::unique_ptr<token_bucket> _write_limit;
+        std::unique_ptr<asio::steady_timer> _read_timer;
+        std::unique_ptr<asio::steady_timer> _write_timer;
+
+        // MSG_ZEROCOPY, only touched on the strand but the flag set once connected.
+        bool _zerocopy = false;
+        bool _zerocopy_watching = false;
+        uint32_t _zerocopy_seq = 0; ///< Number of the next MSG_ZEROCOPY send.
+        uint32_t _zerocopy_epoch = 0; ///< Bumped with each socket, see @ref reset_zerocopy.
+        std::atomic<uint32_t> _zerocopy_unacked{ 0 }; ///< Read by @ref do_close on any thread.
+        std::deque<write_entry> _zerocopy_pending; ///< Sent, not released by the kernel yet.
+
+        // Timeouts, nullptr wheel if none is set.
+        timer *const _timers;
+        std::atomic<bool> _watching{ false };
+        std::atomic<bool> _reading{ false };
+        std::atomic<int64_t> _last_read{ 0 };
+        std::atomic<int64_t> _last_write{ 0 };
+        std::atomic<unsigned> _pings{ 0 }; ///< Heartbeats sent since the last read.
+
+        // Reconnection.
+        asio::io_context &_ioc;
+        std::atomic<bool> _closed{ false };
+        std::atomic<unsigned> _connect_attempts{ 0 };
     };
 
+    // Protocol specific members, defined and instantiated in session.cpp: the stream protocols
+    // take the TCP paths, the datagram ones the UDP paths.
+#define BEAUTY_STREAM_SESSION(EXTERN, P)                                                           \
+    EXTERN template void session<P>::do_read(const size_t, bool);                                  \
+    EXTERN template void session<P>::on_read(const endpoint<P> &, error_code, std::size_t);        \
+    EXTERN template void session<P>::do_write(const boost::asio::const_buffer &&, bool);           \
+    EXTERN template void session<P>::write_head();                                                 \
+    EXTERN template void session<P>::send_file_chunk(error_code, clock_type::time_point);          \
+    EXTERN template void session<P>::send_zerocopy_chunk(error_code, clock_type::time_point);      \
+    EXTERN template void session<P>::watch_zerocopy();                                             \
+    EXTERN template void session<P>::reap_zerocopy(error_code);                                    \
+    EXTERN template error_code session<P>::drain_zerocopy();                                       \
+    EXTERN template void session<P>::resume_read(const endpoint<P> &);
+
+#define BEAUTY_DATAGRAM_SESSION(EXTERN, P)                                                         \
+    EXTERN template void session<P>::receive(endpoint<P>, bool, const size_t);                     \
+    EXTERN template void session<P>::on_read(const endpoint<P> &, error_code, std::size_t);        \
+    EXTERN template void session<P>::do_write(const boost::asio::const_buffer &&, bool);           \
+    EXTERN template void session<P>::write_head();                                                 \
+    EXTERN template void session<P>::watch_zerocopy();                                             \
+    EXTERN template void session<P>::resume_read(const endpoint<P> &);
+
+    BEAUTY_STREAM_SESSION(extern, tcp)
+    BEAUTY_DATAGRAM_SESSION(extern, udp)
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    BEAUTY_STREAM_SESSION(extern, local_stream)
+    BEAUTY_DATAGRAM_SESSION(extern, local_datagram)
+#endif
+
 } // namespace beauty
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <beauty/header.hpp>
+#include <beauty/histogram.hpp>
+#include <beauty/metrics.hpp>
+#include <beauty/server.hpp>
+
+#include <boost/asio.hpp>
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+namespace beauty {
+
+    // --------------------------------------------------------------------------
+    // Stats endpoint
+    // --------------------------------------------------------------------------
+
+    /**
+     * @brief Opt-in HTTP listener serving a Prometheus-style text exposition of the library
+     *      @ref metrics and of registered latency histograms.
+     *
+     * It runs its own @ref tcp_server with one worker, so rendering never runs on the IO workers
+     * of the observed servers and clients; those are only read through their lock-free counters.
+     * Any `GET` on `/` or `/metrics` is answered, then the connection is closed.
+     */
+    class stats_server {
+
+        using cb_t = callback<tcp>;
+        using sess_t = session<tcp>;
+
+    public:
+        using latency_source = std::function<latency_snapshot()>;
+
+        stats_server(std::string name = "stats_server")
+            : _server(name)
+        {
+            _callback.on_read = [this](sess_t &sess, boost::asio::streambuf &buf, size_t size) {
+                auto data = static_cast<const char *>(buf.data().data());
+                _request.append(data, size);
+                if (_request.find("\r\n\r\n") != std::string::npos) {
+                    respond(sess);
+                }
+                return true;
+            };
+            _callback.on_write = [this](sess_t &sess, const size_t size) {
+                _sent += size;
+                if (_sent < _response.size()) {
+                    _chunk = _response.substr(_sent);
+                    sess.write(_chunk, false);
+                } else {
+                    sess.close();
+                }
+            };
+            _callback.on_disconnected = [this](sess_t &, endpoint<tcp>) { _request.clear(); };
+        }
+
+        stats_server(const stats_server &) = delete;
+        stats_server &operator=(const stats_server &) = delete;
+
+        /**
+         * @brief Start serving.
+         * @param port Local listening endpoint's port.
+         * @param verbose Verbose for the session of the connection.
+         * @return stats_server&
+         */
+        stats_server &listen(int port, int verbose = 0)
+        {
+            _server.concurrency(1);
+            _server.listen(port, _callback, verbose);
+            return *this;
+        }
+
+        /**
+         * @brief Expose latency histograms, e.g. `[&] { return server.latency(5580); }`.
+         *      The source is called on the stats thread for every scrape.
+         * @param name Label value of the `source` label.
+         * @param source Snapshot provider.
+         */
+        stats_server &expose(const std::string &name, latency_source source)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _sources[name] = std::move(source);
+            return *this;
+        }
+
+        void stop() { _server.stop(); }
+
+        /**
+         * @brief Render the text exposition.
+         */
+        std::string render() const
+        {
+            std::ostringstream out;
+
+            auto snap = metrics::snapshot();
+            for (size_t i = 0; i < metrics_snapshot::size; ++i) {
+                auto m = static_cast<metric>(i);
+                bool gauge = metrics_snapshot::is_gauge(m);
+                std::string name = std::string("beauty_") + metrics_snapshot::name(m)
+                    + (gauge ? "" : "_total");
+                out << "# TYPE " << name << (gauge ? " gauge\n" : " counter\n");
+                out << name << " " << snap.values[i] << "\n";
+            }
+
+            std::map<std::string, latency_source> sources;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                sources = _sources;
+            }
+            if (sources.empty()) {
+                return out.str();
+            }
+
+            std::map<std::string, latency_snapshot> lat;
+            for (auto &src : sources) {
+                lat[src.first] = src.second();
+            }
+            render_histogram(out, "beauty_read_seconds", lat, &latency_snapshot::read);
+            render_histogram(out, "beauty_write_seconds", lat, &latency_snapshot::write);
+            render_histogram(out, "beauty_callback_seconds", lat, &latency_snapshot::callback);
+            return out.str();
+        }
+
+    private:
+        void respond(sess_t &sess)
+        {
+            bool found = _request.compare(0, 6, "GET / ") == 0
+                || _request.compare(0, 13, "GET /metrics ") == 0
+                || _request.compare(0, 13, "GET /metrics?") == 0;
+            std::string body = found ? render() : std::string("not found\n");
+
+            std::ostringstream head;
+            head << "HTTP/1.1 " << (found ? "200 OK" : "404 Not Found") << "\r\n"
+                 << "Content-Type: text/plain; version=0.0.4\r\n"
+                 << "Content-Length: " << body.size() << "\r\n"
+                 << "Connection: close\r\n\r\n";
+            _response = head.str() + body;
+            _sent = 0;
+            _request.clear();
+
+            // Sync write on the stats thread, continued in on_write until fully sent.
+            sess.write(_response, false);
+        }
+
+        static void render_histogram(std::ostringstream &out, const char *name,
+            const std::map<std::string, latency_snapshot> &lat,
+            histogram::snapshot latency_snapshot::*which)
+        {
+            out << "# TYPE " << name << " histogram\n";
+            for (auto &src : lat) {
+                const histogram::snapshot &h = src.second.*which;
+                const std::string label = "source=\"" + src.first + "\"";
+
+                // One bucket per power of two, up to the highest recorded value.
+                size_t last = 0;
+                for (size_t i = 0; i < histogram::bucket_count; ++i) {
+                    if (h.counts[i]) {
+                        last = i;
+                    }
+                }
+                const size_t step = size_t(1) << histogram::sub_bits;
+                uint64_t cumulated = 0;
+                for (size_t i = 0; i < histogram::bucket_count && h.count; ++i) {
+                    cumulated += h.counts[i];
+                    if ((i + 1) % step == 0 || i == last) {
+                        out << name << "_bucket{" << label << ",le=\""
+                            << histogram::upper_bound(i) / 1e9 << "\"} " << cumulated << "\n";
+                    }
+                    if (i >= last) {
+                        break;
+                    }
+                }
+                out << name << "_bucket{" << label << ",le=\"+Inf\"} " << h.count << "\n";
+                out << name << "_sum{" << label << "} " << h.sum / 1e9 << "\n";
+                out << name << "_count{" << label << "} " << h.count << "\n";
+            }
+        }
+
+        tcp_server _server;
+        cb_t _callback;
+        std::string _request;
+        std::string _response;
+        std::string _chunk;
+        size_t _sent = 0;
+        mutable std::mutex _mutex;
+        std::map<std::string, latency_source> _sources;
+    };
+
+} // namespace beauty
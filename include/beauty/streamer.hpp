@@ -0,0 +1,219 @@
+#pragma once
+
+#include <beauty/file.hpp>
+#include <beauty/session.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace beauty {
+
+    // --------------------------------------------------------------------------
+    // Memory mapped file streaming
+    // --------------------------------------------------------------------------
+
+    /**
+     * @brief Streams a file region to a session through its async write queue, window by window
+     *      of a read only memory mapping. The windows are written as they are, never copied
+     *      into user buffers, and each is unmapped once written. At most `in_flight` windows are
+     *      mapped at a time, so the file may be larger than the memory; `MADV_SEQUENTIAL` makes
+     *      the kernel read ahead and drop the pages behind. Unlike @ref session::send_file, a
+     *      framing header can precede every window, and it works wherever `sendfile` does not.
+     *      With @ref options::zerocopy_threshold the windows go out with `MSG_ZEROCOPY`.
+     *
+     * @code
+     * auto streamer = std::make_shared<beauty::file_streamer<beauty::tcp>>(sess);
+     * streamer->window(1 << 20, 4).framing([](uint64_t offset, size_t length) {
+     *     return make_header(offset, length);
+     * });
+     * streamer->start("video.bin", 0, 0, [](beauty::error_code ec, uint64_t bytes) {});
+     * @endcode
+     *
+     * @note The file must not shrink while streamed, the missing pages fail the writes.
+     */
+    template <typename _Protocol>
+    class file_streamer : public std::enable_shared_from_this<file_streamer<_Protocol>> {
+    public:
+        using sess_t = session<_Protocol>;
+        /// Header written before the window of `length` bytes from `offset`.
+        using frame_t = std::function<std::vector<uint8_t>(uint64_t offset, size_t length)>;
+        /// Called once, with the file bytes written, when done or failed.
+        using done_t = std::function<void(error_code, uint64_t bytes)>;
+
+        explicit file_streamer(std::shared_ptr<sess_t> sess)
+            : _session(std::move(sess))
+        {
+        }
+
+        /**
+         * @brief Size of the mapped windows, rounded up to whole pages, and how many are
+         *      queued at once. 4 windows of 4 MB by default.
+         */
+        file_streamer &window(size_t size, size_t in_flight)
+        {
+            const size_t page = page_size();
+            _window = size ? (size + page - 1) / page * page : page;
+            _max_in_flight = in_flight ? in_flight : 1;
+            return *this;
+        }
+
+        /**
+         * @brief Write `frame(offset, length)` before each window.
+         */
+        file_streamer &framing(frame_t frame)
+        {
+            _frame = std::move(frame);
+            return *this;
+        }
+
+        /**
+         * @brief Stream `length` bytes of `path` from `offset`, up to its end if `length` is 0.
+         * @return The open error, `done` is then never called.
+         */
+        error_code start(
+            const std::string &path, uint64_t offset, uint64_t length, done_t done = {})
+        {
+            error_code ec = _file.open(path, offset, length);
+            return ec ? ec : start(std::move(done));
+        }
+
+        /**
+         * @brief Stream a region of an open file, see above.
+         * @param fd Left open, must stay so until `done`.
+         */
+        error_code start(int fd, uint64_t offset, uint64_t length, done_t done = {})
+        {
+            error_code ec = _file.assign(fd, offset, length, false);
+            return ec ? ec : start(std::move(done));
+        }
+
+        /**
+         * @brief File bytes written so far.
+         */
+        uint64_t written() const
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _written;
+        }
+
+    private:
+        error_code start(done_t done)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _done = std::move(done);
+            }
+            pump();
+            return {};
+        }
+
+        static size_t page_size()
+        {
+#ifndef _WIN32
+            static const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+            return page;
+#else
+            return 4096;
+#endif
+        }
+
+        // Queue windows until `_max_in_flight` are, or the end of the file.
+        void pump()
+        {
+            done_t done;
+            error_code result;
+            uint64_t written = 0;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                while (!_ec && _file.left && _in_flight < _max_in_flight) {
+                    queue_window();
+                }
+                if (_in_flight || _finished || (!_ec && _file.left)) {
+                    return;
+                }
+                _finished = true;
+                done = std::move(_done);
+                result = _ec;
+                written = _written;
+            }
+            if (done) {
+                done(result, written);
+            }
+        }
+
+        // Map the next window and queue it, under the lock.
+        void queue_window()
+        {
+            const size_t length = static_cast<size_t>(std::min<uint64_t>(_file.left, _window));
+            const uint64_t offset = _file.offset;
+#ifndef _WIN32
+            // The mapping starts on a page boundary.
+            const uint64_t base = offset / page_size() * page_size();
+            const size_t size = static_cast<size_t>(offset - base) + length;
+            void *map = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, _file.fd, base);
+            if (map == MAP_FAILED) {
+                _ec = error_code(errno, boost::system::system_category());
+                return;
+            }
+            ::madvise(map, size, MADV_SEQUENTIAL);
+            ::madvise(map, size, MADV_WILLNEED);
+            std::shared_ptr<const void> owner(map, [size](const void *p) {
+                ::munmap(const_cast<void *>(p), size);
+            });
+            const char *data = static_cast<const char *>(map) + (offset - base);
+
+            _file.offset += length;
+            _file.left -= length;
+            ++_in_flight;
+            if (_frame) {
+                _session->write(_frame(offset, length), true);
+            }
+            // Ordered with the header by the lock, as the session queues in call order.
+            _session->write(boost::asio::buffer(data, length), std::move(owner),
+                [me = this->shared_from_this()](error_code ec, size_t tbytes) {
+                    me->on_window(ec, tbytes);
+                });
+#else
+            (void)length;
+            (void)offset;
+            _ec = boost::asio::error::operation_not_supported;
+#endif
+        }
+
+        void on_window(error_code ec, size_t tbytes)
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                --_in_flight;
+                _written += tbytes;
+                if (ec && !_ec) {
+                    _ec = ec;
+                }
+            }
+            pump();
+        }
+
+        std::shared_ptr<sess_t> _session;
+        file_region _file;
+        size_t _window = 4 << 20;
+        size_t _max_in_flight = 4;
+        frame_t _frame;
+        done_t _done;
+
+        mutable std::mutex _mutex;
+        size_t _in_flight = 0;
+        uint64_t _written = 0;
+        error_code _ec;
+        bool _finished = false;
+    };
+
+} // namespace beauty
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+
+namespace beauty {
+
+    // --------------------------------------------------------------------------
+    // Bandwidth throttling
+    // --------------------------------------------------------------------------
+
+    /**
+     * @brief Byte token bucket of one session direction, see @ref options::read_rate.
+     *      Transfers are charged after the fact and may overdraw the bucket, the next one then
+     *      waits for @ref delay. Only used on the session strand, so not synchronized.
+     */
+    class token_bucket {
+        using clock_type = std::chrono::steady_clock;
+
+    public:
+        /**
+         * @param rate Bytes per second.
+         * @param burst Bucket size in bytes, one second of `rate` if 0.
+         */
+        token_bucket(double rate, double burst)
+            : _rate(rate)
+            , _burst(burst > 0 ? burst : rate)
+            , _tokens(_burst)
+            , _last(clock_type::now())
+        {
+        }
+
+        void consume(size_t bytes)
+        {
+            refill();
+            _tokens -= static_cast<double>(bytes);
+        }
+
+        /**
+         * @brief Time to wait before the next transfer, zero if it can go now.
+         */
+        clock_type::duration delay()
+        {
+            refill();
+            if (_tokens >= 0) {
+                return clock_type::duration::zero();
+            }
+            return std::chrono::duration_cast<clock_type::duration>(
+                std::chrono::duration<double>(-_tokens / _rate));
+        }
+
+        /**
+         * @brief Largest transfer worth issuing at once.
+         */
+        size_t chunk() const { return std::max<size_t>(1, static_cast<size_t>(_burst)); }
+
+    private:
+        void refill()
+        {
+            auto now = clock_type::now();
+            double elapsed = std::chrono::duration<double>(now - _last).count();
+            _tokens = std::min(_burst, _tokens + elapsed * _rate);
+            _last = now;
+        }
+
+        const double _rate;
+        const double _burst;
+        double _tokens;
+        clock_type::time_point _last;
+    };
+
+} // namespace beauty
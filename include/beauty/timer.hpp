@@ -0,0 +1,311 @@
+#pragma once
+
+#include <boost/asio.hpp>
+
+#include <array>
+#include <ctime>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#ifndef BEAUTY_TIMER_TICK_MS
+#define BEAUTY_TIMER_TICK_MS 10
+#endif
+
+namespace asio = boost::asio;
+
+namespace beauty {
+
+    // --------------------------------------------------------------------------
+    // Timer wheel
+    // --------------------------------------------------------------------------
+
+    /**
+     * @brief Hashed hierarchical timer wheel, one per io_context: `timer::get(ioc)` or
+     *      @ref application::timers.
+     *
+     * Four levels of 256 slots cover `BEAUTY_TIMER_TICK_MS` (10 ms) up to 2^32 ticks, longer
+     * delays are clamped. Scheduling and cancelling link or unlink a pooled node in O(1) under
+     * a mutex, timers of the upper levels cascade down as the wheel turns. A single
+     * `steady_timer` ticks only while timers are pending, and handlers run on the io_context,
+     * outside of the lock, at most one tick late.
+     */
+    class timer : public asio::io_context::service {
+        static constexpr unsigned level_bits = 8;
+        static constexpr unsigned levels = 4;
+        static constexpr uint32_t slots = 1u << level_bits;
+        static constexpr uint32_t npos = UINT32_MAX;
+        static constexpr uint64_t max_ticks = (uint64_t(1) << (level_bits * levels)) - 1;
+
+    public:
+        using clock_type = std::chrono::steady_clock;
+        using handler_t = std::function<void()>;
+
+        static constexpr std::chrono::milliseconds tick{ BEAUTY_TIMER_TICK_MS };
+
+        /**
+         * @brief Identifies a scheduled timer, stale once fired or cancelled.
+         */
+        struct handle {
+            uint32_t index = 0;
+            uint32_t generation = 0; ///< 0 for no timer.
+
+            explicit operator bool() const { return generation != 0; }
+        };
+
+        inline static asio::io_context::id id;
+
+        explicit timer(asio::io_context &ioc)
+            : asio::io_context::service(ioc)
+            , _tick_timer(ioc)
+        {
+            _heads.fill(npos);
+        }
+
+        static timer &get(asio::io_context &ioc) { return asio::use_service<timer>(ioc); }
+
+        /**
+         * @brief Cheap steady time, for activity timestamps. On Linux it only has the resolution
+         *      of the kernel tick (a few milliseconds) but costs no more than a memory read.
+         */
+        static clock_type::time_point coarse_now()
+        {
+#ifdef CLOCK_MONOTONIC_COARSE
+            timespec ts;
+            ::clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+            return clock_type::time_point(std::chrono::duration_cast<clock_type::duration>(
+                std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec)));
+#else
+            return clock_type::now();
+#endif
+        }
+
+        /**
+         * @brief Call `h` on the io_context after `delay`.
+         */
+        handle schedule(clock_type::duration delay, handler_t h)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_ticking) {
+                // Resume the wheel where it stopped, without catching up the idle time.
+                _base = clock_type::now() - ticks(_jiffies);
+            }
+            uint64_t count = 1;
+            if (delay > clock_type::duration::zero()) {
+                count = static_cast<uint64_t>((delay + tick - clock_type::duration(1)) / tick);
+                count = count > max_ticks ? max_ticks : count;
+            }
+
+            uint32_t i = allocate();
+            node &n = _nodes[i];
+            n.handler = std::move(h);
+            n.expires = _jiffies + count;
+            link(i);
+            ++_count;
+
+            if (!_ticking) {
+                _ticking = true;
+                arm();
+            }
+            return { i, n.generation };
+        }
+
+        /**
+         * @brief Cancel a timer and reset the handle.
+         * @return `false` if it already fired, or is firing, or was cancelled.
+         */
+        bool cancel(handle &h)
+        {
+            handler_t dropped;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (!h || h.index >= _nodes.size() || _nodes[h.index].generation != h.generation) {
+                    h = {};
+                    return false;
+                }
+                unlink(h.index);
+                dropped = release(h.index);
+                --_count;
+            }
+            h = {};
+            return true;
+        }
+
+        /**
+         * @brief Timers pending.
+         */
+        size_t size() const
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _count;
+        }
+
+    private:
+        struct node {
+            handler_t handler;
+            uint64_t expires = 0;
+            uint32_t generation = 1;
+            uint32_t prev = npos;
+            uint32_t next = npos;
+            uint32_t bucket = npos; ///< level * slots + slot while linked, next free otherwise.
+        };
+
+        void shutdown() override
+        {
+            std::vector<node> nodes;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _tick_timer.cancel();
+                nodes.swap(_nodes);
+                _heads.fill(npos);
+                _free = npos;
+                _count = 0;
+            }
+            // Handlers, and what they hold, are destroyed outside of the lock.
+        }
+
+        static clock_type::duration ticks(uint64_t n)
+        {
+            return std::chrono::duration_cast<clock_type::duration>(tick)
+                * static_cast<clock_type::rep>(n);
+        }
+
+        uint32_t allocate()
+        {
+            if (_free != npos) {
+                uint32_t i = _free;
+                _free = _nodes[i].bucket;
+                return i;
+            }
+            _nodes.emplace_back();
+            return static_cast<uint32_t>(_nodes.size() - 1);
+        }
+
+        handler_t release(uint32_t i)
+        {
+            node &n = _nodes[i];
+            handler_t h = std::move(n.handler);
+            n.handler = nullptr;
+            n.generation = n.generation + 1 ? n.generation + 1 : 1;
+            n.bucket = _free;
+            _free = i;
+            return h;
+        }
+
+        void link(uint32_t i)
+        {
+            node &n = _nodes[i];
+            uint64_t delta = n.expires > _jiffies ? n.expires - _jiffies : 0;
+            uint64_t when = _jiffies + delta;
+            unsigned level = 0;
+            while (level + 1 < levels && delta >= (uint64_t(1) << (level_bits * (level + 1)))) {
+                ++level;
+            }
+            uint32_t bucket = level * slots
+                + static_cast<uint32_t>((when >> (level_bits * level)) & (slots - 1));
+            n.bucket = bucket;
+            n.prev = npos;
+            n.next = _heads[bucket];
+            if (n.next != npos) {
+                _nodes[n.next].prev = i;
+            }
+            _heads[bucket] = i;
+        }
+
+        void unlink(uint32_t i)
+        {
+            node &n = _nodes[i];
+            if (n.prev != npos) {
+                _nodes[n.prev].next = n.next;
+            } else {
+                _heads[n.bucket] = n.next;
+            }
+            if (n.next != npos) {
+                _nodes[n.next].prev = n.prev;
+            }
+            n.prev = n.next = npos;
+        }
+
+        // Move the timers of one upper slot down, when the lower level wraps.
+        void cascade(unsigned level)
+        {
+            uint32_t bucket = level * slots
+                + static_cast<uint32_t>((_jiffies >> (level_bits * level)) & (slots - 1));
+            uint32_t i = _heads[bucket];
+            _heads[bucket] = npos;
+            while (i != npos) {
+                uint32_t next = _nodes[i].next;
+                link(i);
+                i = next;
+            }
+        }
+
+        // Process one tick, collecting the expired handlers.
+        void turn(std::vector<handler_t> &expired)
+        {
+            for (unsigned level = 1; level < levels; ++level) {
+                if ((_jiffies >> (level_bits * (level - 1))) & (slots - 1)) {
+                    break;
+                }
+                cascade(level);
+            }
+            uint32_t bucket = static_cast<uint32_t>(_jiffies & (slots - 1));
+            uint32_t i = _heads[bucket];
+            _heads[bucket] = npos;
+            while (i != npos) {
+                uint32_t next = _nodes[i].next;
+                expired.push_back(release(i));
+                --_count;
+                i = next;
+            }
+            ++_jiffies;
+        }
+
+        void arm()
+        {
+            _tick_timer.expires_at(_base + ticks(_jiffies + 1));
+            _tick_timer.async_wait([this](const boost::system::error_code &ec) {
+                if (!ec) {
+                    on_tick();
+                }
+            });
+        }
+
+        void on_tick()
+        {
+            std::vector<handler_t> expired;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                const uint64_t target = static_cast<uint64_t>((clock_type::now() - _base) / tick);
+                while (_jiffies <= target && _count) {
+                    turn(expired);
+                }
+                if (_jiffies <= target) {
+                    _jiffies = target + 1;
+                }
+                if (_count) {
+                    arm();
+                } else {
+                    _ticking = false;
+                }
+            }
+            for (auto &h : expired) {
+                h();
+            }
+        }
+
+        mutable std::mutex _mutex;
+        asio::steady_timer _tick_timer;
+        clock_type::time_point _base;
+        uint64_t _jiffies = 0; ///< Next tick to process.
+        bool _ticking = false;
+        size_t _count = 0;
+        std::vector<node> _nodes;
+        uint32_t _free = npos;
+        std::array<uint32_t, slots * levels> _heads;
+    };
+
+} // namespace beauty
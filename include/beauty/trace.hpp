@@ -0,0 +1,53 @@
+#pragma once
+
+// --------------------------------------------------------------------------
+// Static tracepoints
+// --------------------------------------------------------------------------
+//
+// Build with `USING_USDT` (and systemtap's <sys/sdt.h>) to place USDT probes in the IO path.
+// Each probe is a single nop until a tracer attaches, e.g.
+//
+//      bpftrace -e 'usdt:./server:beauty:read_complete { @bytes = hist(arg1); }'
+//      perf probe -x ./server sdt_beauty:callback_entry
+//
+// Probes, provider `beauty` (`sess` and `acc` are the object addresses, used as ids):
+//      accept(acc, error)                   acceptor::on_accept
+//      connect(sess, error)                 session::on_connect
+//      read_complete(sess, bytes, error)    session::on_read
+//      write_complete(sess, bytes, error)   session::on_write
+//      close(sess)                          session::do_close
+//      callback_entry(sess, kind)           before a user callback, see @ref beauty::probe_cb
+//      callback_exit(sess, kind)            after a user callback
+//
+// Without `USING_USDT` the macros expand to nothing.
+
+#if defined(USING_USDT) && USING_USDT
+#include <sys/sdt.h>
+#define BEAUTY_PROBE1(name, a)       DTRACE_PROBE1(beauty, name, a)
+#define BEAUTY_PROBE2(name, a, b)    DTRACE_PROBE2(beauty, name, a, b)
+#define BEAUTY_PROBE3(name, a, b, c) DTRACE_PROBE3(beauty, name, a, b, c)
+#else
+#define BEAUTY_PROBE1(name, a)       (void)0
+#define BEAUTY_PROBE2(name, a, b)    (void)0
+#define BEAUTY_PROBE3(name, a, b, c) (void)0
+#endif
+
+namespace beauty {
+
+    /**
+     * @brief `kind` argument of the callback_entry/callback_exit probes.
+     */
+    enum probe_cb : int {
+        probe_on_accepted = 0,
+        probe_on_connected,
+        probe_on_connect_failed,
+        probe_on_disconnected,
+        probe_on_read,
+        probe_on_read_failed,
+        probe_on_write,
+        probe_on_write_failed,
+        probe_on_write_backpressure,
+        probe_on_timeout,
+    };
+
+} // namespace beauty
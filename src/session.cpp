@@ -1,135 +1,352 @@
 #include <beauty/session.hpp>
 
+#if defined(__linux__)
+#include <linux/errqueue.h>
+#include <sys/sendfile.h>
+#endif
+
 namespace beauty {
 
-    void session<udp>::receive(endpoint<udp> ep, bool async, const size_t buffer_size)
+    template <typename _Protocol>
+    void session<_Protocol>::receive(edp_t ep, bool async, const size_t buffer_size)
     {
+        if (async && off_io_thread()) {
+            asio::post(_strand, [me = this->shared_from_this(), ep, buffer_size]() {
+                me->receive(ep, true, buffer_size);
+            });
+            return;
+        }
         if (!_socket.is_open()) {
             error_code ec;
             _socket.open(ep.protocol(), ec);
             if (ec) {
                 BEAUTY_ERROR(_verbose > 0,
-                    "Open UDP socket for " << ep << " faild with error (" << ec.value()
-                                           << "): " << ec.message());
+                    "Open socket for " << ep << " faild with error (" << ec.value()
+                                       << "): " << ec.message());
                 return;
             }
             _socket.bind(ep, ec);
             if (ec) {
                 BEAUTY_ERROR(_verbose > 0,
-                    "Bind UDP port for " << ep << " faild with error (" << ec.value()
-                                         << "): " << ec.message());
+                    "Bind socket to " << ep << " faild with error (" << ec.value()
+                                      << "): " << ec.message());
                 return;
             }
+            set_socket_options();
         }
-        BEAUTY_INFO(
-            _verbose > 1, "Start " << (async ? "an async" : "a sync") << " receiving from " << ep);
+        BEAUTY_VINFO(
+            2, _verbose, "Start " << (async ? "an async" : "a sync") << " receiving from " << ep);
         boost::asio::streambuf::mutable_buffers_type mbuf = _buffer.prepare(buffer_size);
+        auto t0 = stamp();
         if (async) {
-            _socket.async_receive(mbuf, [me = this->shared_from_this(), ep](auto ec, auto tbytes) {
-                me->on_read(ep, ec, tbytes);
-            });
+            reading();
+            _socket.async_receive(mbuf,
+                asio::bind_executor(
+                    _strand, [me = this->shared_from_this(), ep, t0](auto ec, auto tbytes) {
+                        me->record(&latency_histograms::read, t0);
+                        me->on_read(ep, ec, tbytes);
+                    }));
         } else {
             error_code ec;
             size_t tbytes = _socket.receive_from(mbuf, ep);
+            record(&latency_histograms::read, t0);
             on_read(ep, ec, tbytes);
         }
     }
 
-    void session<tcp>::do_read(const size_t buffer_size, bool async)
+    template <typename _Protocol>
+    void session<_Protocol>::do_read(const size_t buffer_size, bool async)
     {
-        BEAUTY_INFO(_verbose > 1, "Arrise " << (async ? "an async" : "a sync") << " read action.");
+        if (async && off_io_thread()) {
+            asio::post(_strand, [me = this->shared_from_this(), buffer_size]() {
+                me->do_read(buffer_size, true);
+            });
+            return;
+        }
+        BEAUTY_VINFO(2, _verbose, "Arrise " << (async ? "an async" : "a sync") << " read action.");
         boost::asio::streambuf::mutable_buffers_type mbuf = _buffer.prepare(buffer_size);
+        auto t0 = stamp();
         if (async) {
+            reading();
             this->_socket.async_read_some(mbuf,
-                asio::bind_executor(_strand, [me = this->shared_from_this()](auto ec, auto tbytes) {
-                    me->on_read({}, ec, tbytes);
-                }));
+                asio::bind_executor(
+                    _strand, [me = this->shared_from_this(), t0](auto ec, auto tbytes) {
+                        me->record(&latency_histograms::read, t0);
+                        me->on_read({}, ec, tbytes);
+                    }));
         } else {
             error_code ec;
             size_t tbytes = _socket.read_some(mbuf, ec);
+            record(&latency_histograms::read, t0);
             on_read({}, ec, tbytes);
         }
     }
 
-    template <>
-    void session<tcp>::on_read(const edp_t & /* ep not used */, error_code ec, std::size_t tbytes)
+    template <typename _Protocol>
+    void session<_Protocol>::on_read(const edp_t &ep, error_code ec, std::size_t tbytes)
     {
+        read_done();
         if (ec) {
-            BEAUTY_ERROR(
-                _verbose > 0, "Read faild with error (" << ec.value() << "): " << ec.message());
-            if (_callback.on_read_failed(*this, ec) && _is_connnected) {
-                read(true);
+            BEAUTY_ERROR_RL(_verbose > 0, BEAUTY_ERROR_RATE, BEAUTY_ERROR_BURST,
+                "Read faild with error (" << ec.value() << "): " << ec.message());
+            BEAUTY_PROBE3(read_complete, this, tbytes, ec.value());
+            journal::record(journal_event::read, _id, tbytes, ec.value());
+            metrics::add(metric::read_errors);
+            // A stream is only read again while connected.
+            if (invoke(probe_on_read_failed, _callback.on_read_failed, *this, ec)
+                && (!is_stream<_Protocol>::value || _is_connnected)) {
+                resume_read(ep);
             } else {
                 do_close();
             }
         } else {
-            BEAUTY_INFO(_verbose > 1, "Successfully read " << tbytes << " bytes.");
+            BEAUTY_VINFO(2, _verbose,
+                BEAUTY_LITERAL("Successfully read ") << tbytes << BEAUTY_LITERAL(" bytes."));
+            BEAUTY_PROBE3(read_complete, this, tbytes, 0);
+            journal::record(journal_event::read, _id, tbytes, 0);
+            metrics::add(metric::bytes_read, static_cast<int64_t>(tbytes));
+            metrics::add(metric::messages_read);
             bool read_more = false;
             _buffer.commit(tbytes);
-            if (_callback.on_read(*this, _buffer, tbytes)) {
+            auto t0 = stamp();
+            if (invoke(probe_on_read, _callback.on_read, *this, _buffer, tbytes)) {
                 read_more = true;
             }
+            record(&latency_histograms::callback, t0);
             _buffer.consume(tbytes);
             if (read_more)
-                read(true);
+                rearm_read(ep, tbytes);
         }
     }
 
-    template <>
-    void session<udp>::on_read(const edp_t &ep, error_code ec, std::size_t tbytes)
+    template <typename _Protocol>
+    void session<_Protocol>::do_write(const boost::asio::const_buffer &&buffer, bool async)
     {
-        if (ec) {
-            BEAUTY_ERROR(
-                _verbose > 0, "Read faild with error (" << ec.value() << "): " << ec.message());
-            if (_callback.on_read_failed(*this, ec)) {
-                receive(ep, true);
+        BEAUTY_VINFO(2, _verbose, "Arrise " << (async ? "an async" : "a sync") << " write action.");
+        if (async) {
+            enqueue({ buffer, nullptr });
+        } else {
+            auto t0 = stamp();
+            error_code ec;
+            size_t tbytes = 0;
+            if constexpr (is_stream<_Protocol>::value) {
+                tbytes = this->_socket.write_some(buffer, ec);
             } else {
-                do_close();
+                tbytes = this->_socket.send(buffer, 0, ec);
             }
-        } else {
-            BEAUTY_INFO(_verbose > 1, "Successfully read " << tbytes << " bytes.");
-            // Copy data from to temporary buffer.
-            bool read_more = false;
-            _buffer.commit(tbytes);
-            if (_callback.on_read(*this, _buffer, tbytes)) {
-                read_more = true;
+            record(&latency_histograms::write, t0);
+            if (on_write(ec, tbytes) && ec) {
+                enqueue({ buffer, nullptr });
             }
-            _buffer.consume(tbytes);
-            if (read_more)
-                receive(ep, true);
         }
     }
 
-    void session<tcp>::do_write(const boost::asio::const_buffer &&buffer, bool async)
+    template <typename _Protocol>
+    void session<_Protocol>::write_head()
     {
-        BEAUTY_INFO(_verbose > 1, "Arrise " << (async ? "an async" : "a sync") << " write action.");
-        boost::asio::const_buffer copy_buffer = buffer;
-        if (async) {
-            this->_socket.async_write_some(buffer,
-                asio::bind_executor(this->_strand,
-                    [me = this->shared_from_this(), copy_buffer](
-                        auto ec, auto tbytes) { me->on_write(copy_buffer, ec, tbytes); }));
+        auto t0 = stamp();
+        if constexpr (!is_stream<_Protocol>::value) {
+            this->_socket.async_send(_write_queue.front().buffer,
+                asio::bind_executor(
+                    this->_strand, [me = this->shared_from_this(), t0](auto ec, auto tbytes) {
+                        me->record(&latency_histograms::write, t0);
+                        me->on_queued_write(ec, tbytes);
+                    }));
         } else {
-            error_code ec;
-            size_t tbytes = this->_socket.write_some(buffer, ec);
-            on_write(std::move(copy_buffer), ec, tbytes);
+            if (_write_queue.front().file) {
+                // Readiness driven: wait for room in the socket buffer, then fill it from the
+                // file.
+                this->_socket.async_wait(socket_t::wait_write,
+                    asio::bind_executor(
+                        this->_strand, [me = this->shared_from_this(), t0](auto ec) {
+                            me->send_file_chunk(ec, t0);
+                        }));
+                return;
+            }
+            if (zerocopy(_write_queue.front())) {
+                this->_socket.async_wait(socket_t::wait_write,
+                    asio::bind_executor(
+                        this->_strand, [me = this->shared_from_this(), t0](auto ec) {
+                            me->send_zerocopy_chunk(ec, t0);
+                        }));
+                return;
+            }
+            boost::asio::const_buffer buffer = _write_queue.front().buffer;
+            if (_write_limit) {
+                // Keep the writes in line with the bucket size.
+                buffer = boost::asio::buffer(buffer, _write_limit->chunk());
+            }
+            this->_socket.async_write_some(buffer,
+                asio::bind_executor(
+                    this->_strand, [me = this->shared_from_this(), t0](auto ec, auto tbytes) {
+                        me->record(&latency_histograms::write, t0);
+                        me->on_queued_write(ec, tbytes);
+                    }));
         }
     }
 
-    void session<udp>::do_write(const boost::asio::const_buffer &&buffer, bool async)
+    template <typename _Protocol>
+    void session<_Protocol>::send_file_chunk(error_code ec, clock_type::time_point t0)
     {
-        BEAUTY_INFO(_verbose > 1, "Arrise " << (async ? "an async" : "a sync") << " write action.");
-        boost::asio::const_buffer copy_buffer = buffer;
-        if (async) {
-            this->_socket.async_send(buffer,
+        size_t tbytes = 0;
+        if (!ec) {
+#if defined(__linux__)
+            const file_region &file = *_write_queue.front().file;
+            size_t chunk = static_cast<size_t>(std::min<uint64_t>(file.left, 0x7ffff000));
+            if (_write_limit) {
+                chunk = std::min(chunk, _write_limit->chunk());
+            }
+            if (!_socket.native_non_blocking()) {
+                _socket.native_non_blocking(true, ec);
+            }
+            off_t offset = static_cast<off_t>(file.offset);
+            ssize_t n = ec ? -1 : ::sendfile(_socket.native_handle(), file.fd, &offset, chunk);
+            if (n > 0) {
+                tbytes = static_cast<size_t>(n);
+            } else if (n == 0) {
+                ec = asio::error::eof; // The file is shorter than it was.
+            } else if (!ec && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                write_head(); // Spurious readiness, wait again.
+                return;
+            } else if (!ec) {
+                ec = error_code(errno, boost::system::system_category());
+            }
+#else
+            ec = asio::error::operation_not_supported;
+#endif
+        }
+        record(&latency_histograms::write, t0);
+        on_queued_write(ec, tbytes);
+    }
+
+    template <typename _Protocol>
+    void session<_Protocol>::send_zerocopy_chunk(error_code ec, clock_type::time_point t0)
+    {
+        size_t tbytes = 0;
+        if (!ec) {
+#if defined(MSG_ZEROCOPY)
+            write_entry &head = _write_queue.front();
+            boost::asio::const_buffer buffer = head.buffer;
+            if (_write_limit) {
+                buffer = boost::asio::buffer(buffer, _write_limit->chunk());
+            }
+            const int fd = _socket.native_handle();
+            int flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+            ssize_t n = ::send(fd, buffer.data(), buffer.size(), flags | MSG_ZEROCOPY);
+            if (n < 0 && errno == ENOBUFS) {
+                // Out of locked memory (optmem), copy this one.
+                n = ::send(fd, buffer.data(), buffer.size(), flags);
+            } else if (n >= 0) {
+                // Every accepted send is numbered, in order, by the kernel.
+                if (head.zerocopy_sends++ == 0) {
+                    head.zerocopy_first = _zerocopy_seq;
+                }
+                ++_zerocopy_seq;
+                _zerocopy_unacked.fetch_add(1, std::memory_order_relaxed);
+                metrics::add(metric::zerocopy_sends);
+            }
+            if (n >= 0) {
+                tbytes = static_cast<size_t>(n);
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                write_head(); // Spurious readiness, wait again.
+                return;
+            } else {
+                ec = error_code(errno, boost::system::system_category());
+            }
+#else
+            ec = asio::error::operation_not_supported;
+#endif
+        }
+        record(&latency_histograms::write, t0);
+        on_queued_write(ec, tbytes);
+    }
+
+    template <typename _Protocol>
+    void session<_Protocol>::watch_zerocopy()
+    {
+        if constexpr (is_stream<_Protocol>::value) {
+            if (_zerocopy_watching || _zerocopy_pending.empty()) {
+                return;
+            }
+            // The notifications make the socket readable for errors.
+            _zerocopy_watching = true;
+            this->_socket.async_wait(socket_t::wait_error,
                 asio::bind_executor(this->_strand,
-                    [me = this->shared_from_this(), copy_buffer](
-                        auto ec, auto tbytes) { me->on_write(copy_buffer, ec, tbytes); }));
+                    [me = this->shared_from_this(), epoch = _zerocopy_epoch](auto ec) {
+                        if (epoch == me->_zerocopy_epoch) {
+                            me->_zerocopy_watching = false;
+                            me->reap_zerocopy(ec);
+                        }
+                    }));
+            // The reactor is edge triggered and does not try the wait first: a notification
+            // queued since the send would only be seen with the next one.
+            if (error_code ec = drain_zerocopy()) {
+                reset_zerocopy(asio::error::connection_aborted);
+            }
+        }
+    }
+
+    template <typename _Protocol>
+    void session<_Protocol>::reap_zerocopy(error_code ec)
+    {
+        if (ec || (ec = drain_zerocopy())) {
+            // Closed, see do_close: the data was purged with the connection, if not sent.
+            reset_zerocopy(asio::error::connection_aborted);
+            return;
+        }
+        watch_zerocopy();
+    }
+
+    template <typename _Protocol>
+    error_code session<_Protocol>::drain_zerocopy()
+    {
+        error_code ec;
+#if defined(MSG_ZEROCOPY)
+        while (!_zerocopy_pending.empty()) {
+            char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+            msghdr msg = {};
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (::recvmsg(_socket.native_handle(), &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    ec = error_code(errno, boost::system::system_category());
+                }
+                break;
+            }
+            for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+                if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                        || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                    continue;
+                }
+                const auto *err = reinterpret_cast<const sock_extended_err *>(CMSG_DATA(cm));
+                if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                    continue;
+                }
+                if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    metrics::add(metric::zerocopy_copied, err->ee_data - err->ee_info + 1);
+                }
+                zerocopy_acked(err->ee_info, err->ee_data);
+            }
+        }
+#endif
+        return ec;
+    }
+
+    template <typename _Protocol>
+    void session<_Protocol>::resume_read(const edp_t &ep)
+    {
+        if constexpr (is_stream<_Protocol>::value) {
+            read(true);
         } else {
-            error_code ec;
-            size_t tbytes = this->_socket.send(buffer, 0, ec);
-            on_write(std::move(copy_buffer), ec, tbytes);
+            receive(ep, true);
         }
     }
 
+    BEAUTY_STREAM_SESSION(, tcp)
+    BEAUTY_DATAGRAM_SESSION(, udp)
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS)
+    BEAUTY_STREAM_SESSION(, local_stream)
+    BEAUTY_DATAGRAM_SESSION(, local_datagram)
+#endif
+
 } // namespace beauty
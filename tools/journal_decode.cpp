@@ -0,0 +1,165 @@
+/**
+ * @file journal_decode.cpp
+ * @brief Decoder of the binary connection journal written by @ref beauty::journal.
+ *
+ * Build (from the repository root):
+ *      g++ -std=c++17 -O2 -Iinclude tools/journal_decode.cpp -o journal_decode
+ *
+ * Usage:
+ *      journal_decode <file> [csv|hist]
+ *
+ * `csv` (default) prints one line per record, oldest first:
+ *      seq,unix_ns,steady_ns,session,event,size,error
+ * Records being written when the file was read, or overwritten by the ring, are skipped.
+ *
+ * `hist` prints per event the count, the error count and the size percentiles, then the
+ * session lifetimes (accept or connect to close) percentiles in microseconds.
+ */
+
+#include <beauty/histogram.hpp>
+#include <beauty/journal.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+    const char *event_name(uint8_t ev)
+    {
+        switch (static_cast<beauty::journal_event>(ev)) {
+        case beauty::journal_event::accept:
+            return "accept";
+        case beauty::journal_event::connect:
+            return "connect";
+        case beauty::journal_event::read:
+            return "read";
+        case beauty::journal_event::write:
+            return "write";
+        case beauty::journal_event::close:
+            return "close";
+        }
+        return "unknown";
+    }
+
+    struct event_stats {
+        uint64_t count = 0;
+        uint64_t errors = 0;
+        beauty::histogram sizes;
+    };
+
+    void print_snapshot(const char *name, uint64_t count, uint64_t errors,
+        const beauty::histogram::snapshot &s, const char *unit)
+    {
+        std::printf("%-10s count %-10llu errors %-8llu "
+                    "p50 %llu%s p90 %llu%s p99 %llu%s max %llu%s\n",
+            name, static_cast<unsigned long long>(count), static_cast<unsigned long long>(errors),
+            static_cast<unsigned long long>(s.percentile(0.5)), unit,
+            static_cast<unsigned long long>(s.percentile(0.9)), unit,
+            static_cast<unsigned long long>(s.percentile(0.99)), unit,
+            static_cast<unsigned long long>(s.max()), unit);
+    }
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s <file> [csv|hist]\n", argv[0]);
+        return 2;
+    }
+    const std::string mode = argc > 2 ? argv[2] : "csv";
+
+    std::ifstream in(argv[1], std::ios::binary);
+    if (!in) {
+        std::fprintf(stderr, "cannot open %s\n", argv[1]);
+        return 1;
+    }
+
+    // Read the header field by field, it holds an atomic.
+    char magic[8];
+    uint32_t record_size = 0, reserved = 0;
+    uint64_t capacity = 0, steady_origin = 0, system_origin = 0, head = 0;
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char *>(&record_size), sizeof(record_size));
+    in.read(reinterpret_cast<char *>(&reserved), sizeof(reserved));
+    in.read(reinterpret_cast<char *>(&capacity), sizeof(capacity));
+    in.read(reinterpret_cast<char *>(&steady_origin), sizeof(steady_origin));
+    in.read(reinterpret_cast<char *>(&system_origin), sizeof(system_origin));
+    in.read(reinterpret_cast<char *>(&head), sizeof(head));
+    if (!in || std::memcmp(magic, beauty::journal_header::signature, sizeof(magic)) != 0
+        || record_size != sizeof(beauty::journal_record) || capacity == 0) {
+        std::fprintf(stderr, "%s is not a beauty journal\n", argv[1]);
+        return 1;
+    }
+
+    std::vector<beauty::journal_record> records(capacity);
+    in.seekg(sizeof(beauty::journal_header));
+    in.read(reinterpret_cast<char *>(records.data()),
+        static_cast<std::streamsize>(capacity * sizeof(beauty::journal_record)));
+    if (!in) {
+        std::fprintf(stderr, "%s is truncated\n", argv[1]);
+        return 1;
+    }
+
+    std::map<uint8_t, event_stats> events;
+    std::map<uint64_t, uint64_t> opened;
+    beauty::histogram lifetimes;
+    uint64_t skipped = 0;
+
+    if (mode == "csv") {
+        std::printf("seq,unix_ns,steady_ns,session,event,size,error\n");
+    }
+    const uint64_t first = head > capacity ? head - capacity : 0;
+    for (uint64_t n = first; n < head; ++n) {
+        const beauty::journal_record &r = records[n % capacity];
+        if (r.seq != static_cast<uint32_t>(n + 1)) {
+            ++skipped;
+            continue;
+        }
+        if (mode == "csv") {
+            std::printf("%llu,%llu,%llu,%llu,%s,%u,%d\n", static_cast<unsigned long long>(n),
+                static_cast<unsigned long long>(system_origin + (r.time - steady_origin)),
+                static_cast<unsigned long long>(r.time),
+                static_cast<unsigned long long>(r.session), event_name(r.event), r.size,
+                r.error);
+            continue;
+        }
+
+        auto ev = static_cast<beauty::journal_event>(r.event);
+        auto &stats = events[r.event];
+        ++stats.count;
+        stats.errors += r.error != 0;
+        if (ev == beauty::journal_event::read || ev == beauty::journal_event::write) {
+            stats.sizes.record(r.size);
+        }
+        if ((ev == beauty::journal_event::accept || ev == beauty::journal_event::connect)
+            && r.error == 0) {
+            opened[r.session] = r.time;
+        } else if (ev == beauty::journal_event::close) {
+            auto it = opened.find(r.session);
+            if (it != opened.end()) {
+                lifetimes.record((r.time - it->second) / 1000);
+                opened.erase(it);
+            }
+        }
+    }
+
+    if (mode == "hist") {
+        std::printf("records %llu, skipped %llu, capacity %llu\n",
+            static_cast<unsigned long long>(head - first - skipped),
+            static_cast<unsigned long long>(skipped), static_cast<unsigned long long>(capacity));
+        for (auto &e : events) {
+            print_snapshot(event_name(e.first), e.second.count, e.second.errors,
+                e.second.sizes.get(), "B");
+        }
+        auto l = lifetimes.get();
+        print_snapshot("lifetime", l.count, 0, l, "us");
+    } else if (skipped) {
+        std::fprintf(stderr, "%llu records skipped\n", static_cast<unsigned long long>(skipped));
+    }
+    return 0;
+}